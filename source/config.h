@@ -43,6 +43,16 @@
 // デバッグ時の標準出力への局面表示のとき色を用いる。
 #define FONT_COLOR
 
+// 探索の統計情報(node数の内訳、置換表のhit率、beta cutoffの割合など)を集計する。
+// USIの拡張コマンド"stats"で、前回のgoコマンドでの集計結果を出力できる。
+// defineしなければ集計のコードは生成されないので、探索速度には影響しない。
+// #define USE_SEARCH_STATS
+
+// 探索、指し手生成、do_move()、評価関数のそれぞれで費やしたcycle数、命令数、キャッシュミス、分岐予測ミスを
+// perf_event_open()で計測する。(Linuxのみ) USIの拡張コマンド"perfstat"で計測結果を出力できる。
+// 計測のたびにシステムコールを呼び出して遅くなるので、計測するときだけdefineすること。
+// #define USE_PERF_STAT
+
 // --- assertのレベルを6段階で。
 //  ASSERT_LV 0 : assertなし(全体的な処理が速い)
 //  ASSERT_LV 1 : 軽量なassert
@@ -171,4 +181,9 @@ constexpr bool Is64Bit = false;
 #define USE_MAGIC_BITBOARD
 #endif
 
+// perf_event_open()はLinuxにしかない。
+#if defined (USE_PERF_STAT) && !defined(__linux__)
+#undef USE_PERF_STAT
+#endif
+
 #endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 ﻿#include "evaluate.h"
+#include "perfstat.h"
 
 namespace Eval
 {
@@ -13,6 +14,8 @@ namespace Eval
 
   Value evaluate(const Position& pos)
   {
+    PERF_REGION(EVALUATE);
+
     auto score = VALUE_ZERO;
 
     for (Square sq : SQ)
@@ -6,8 +6,10 @@
 #include <unordered_set>
 #include <cmath>               // sqrt() , fabs()
 #include <sstream>
+#include <functional>
 
 #include "../position.h"
+#include "../thread.h"
 #include "../misc.h"
 
 using namespace std;
@@ -27,7 +29,7 @@ void random_player(Position& pos, uint64_t loop_max)
 	int ply; // 初期局面からの手数
 
 	StateInfo si;
-	pos.set_hirate(&si);
+	pos.set_hirate(&si, Threads.main());
 
 	PRNG prng(20201130);
 
@@ -82,3 +84,284 @@ void random_player_cmd(Position& pos, istringstream& is)
 	random_player(pos, loop_max);
 	cout << "finished." << endl;
 }
+
+// ----------------------------------
+//      USI拡張コマンド "maxmoves"
+// ----------------------------------
+
+// 5五将棋の局面で生成されうる指し手の数の上界を求めて、MAX_MOVESがそれ以上であることを確かめる。
+//
+// 上界 : 手番側の玉以外の駒(歩、銀、金、角、飛 各2枚)を、手駒、盤上(不成)、盤上(成り)、相手側のいずれかに配置する
+//        すべての組み合わせについて、次の和を求めたものの最大値。
+//          盤上の駒 : 空の盤の上で、その駒が指せる指し手の数(成りと不成は別に数える)の、全升での最大値
+//          駒打ち   : 手駒の種類の数 × 空き升の数(両玉と手番側の盤上の駒以外の升)
+//        盤上の駒は他の駒に利きを遮られても指し手が増えることはなく、相手の駒は空き升を減らすだけなので、これは真の上界になる。
+//
+// 検証 : ランダムな局面から山登り法で合法手の多い局面を探す。途中の局面で、各指し手生成器が生成した指し手の数が
+//        上界を超えていないことを確かめる。
+
+namespace {
+
+	// 先手の駒ptが盤上にあるときに、その駒で生成されうる指し手の数の最大値。
+	// 成れる指し手は成りと不成の2手と数える。ただし、歩は1段目に不成で移動できないので1手。
+	int max_piece_moves(Piece pt)
+	{
+		int best = 0;
+		for (Square from = SQ_ZERO; from < SQ_NB; ++from)
+		{
+			// 先手の歩、銀は1段目に置いても指し手がない(歩は置けない)ので飛ばしてよいが、数えても上界は変わらない。
+			Bitboard dst = effects_from(pt, from, ZERO_BB);
+			int n = 0;
+			while (dst)
+			{
+				Square to = dst.pop();
+				bool promotable = (pt == SILVER || pt == BISHOP || pt == ROOK)
+					&& (canPromote(BLACK, from) || canPromote(BLACK, to));
+				n += promotable ? 2 : 1;
+			}
+			best = std::max(best, n);
+		}
+		return best;
+	}
+
+	// 生成されうる指し手の数の上界を求める。
+	int max_moves_upper_bound()
+	{
+		const Piece handTypes[] = { PAWN, SILVER, BISHOP, ROOK, GOLD };
+		int pieceMax[5], proMax[5];
+		for (int i = 0; i < 5; ++i)
+		{
+			pieceMax[i] = max_piece_moves(handTypes[i]);
+			proMax[i] = handTypes[i] == GOLD ? 0 : max_piece_moves(Piece(handTypes[i] + PIECE_PROMOTE));
+		}
+
+		const int kingMax = max_piece_moves(KING);
+
+		int bound = 0;
+
+		// 駒種ごとに、手駒の枚数h、盤上(不成)の枚数b、盤上(成り)の枚数pを決める。残りは相手側。
+		// 同じ駒種の2枚目は1枚目と同じ最大値を使う。
+		std::function<void(int, int, int, int)> rec = [&](int i, int kinds, int onBoard, int moves)
+		{
+			if (i == 5)
+			{
+				// 空き升 = 25 - 両玉 - 手番側の盤上の駒
+				bound = std::max(bound, kingMax + moves + kinds * (int(SQ_NB) - 2 - onBoard));
+				return;
+			}
+
+			for (int h = 0; h <= 2; ++h)
+				for (int b = 0; h + b <= 2; ++b)
+					for (int p = 0; h + b + p <= 2; ++p)
+					{
+						if (handTypes[i] == GOLD && p > 0)
+							continue;
+						rec(i + 1, kinds + (h > 0), onBoard + b + p, moves + b * pieceMax[i] + p * proMax[i]);
+					}
+		};
+		rec(0, 0, 0, 0);
+
+		return bound;
+	}
+
+	// 山登り法で用いる局面の表現。駒ごとに、盤上の升(手駒ならSQ_NB)と駒(先後、成りを含む)を持つ。
+	// [0], [1]は先手玉、後手玉で、常に盤上にある。
+	struct Placement
+	{
+		Square sq[12];
+		Piece pc[12];
+
+		// 局面として正しければ(二歩、行き所のない歩がない)sfen文字列に変換してtrueを返す。
+		bool to_sfen(std::string& sfen) const
+		{
+			Piece board[SQ_NB] = {};
+			int hand[COLOR_NB][PIECE_HAND_NB] = {};
+			for (int i = 0; i < 12; ++i)
+			{
+				if (sq[i] == SQ_NB)
+				{
+					++hand[color_of(pc[i])][type_of(pc[i])];
+					continue;
+				}
+
+				if (board[sq[i]] != NO_PIECE)
+					return false;
+
+				// 行き所のない歩
+				if (type_of(pc[i]) == PAWN && rank_of(sq[i]) == (color_of(pc[i]) == BLACK ? RANK_1 : RANK_5))
+					return false;
+
+				// 二歩
+				if (type_of(pc[i]) == PAWN)
+					for (Rank r = RANK_1; r <= RANK_5; ++r)
+						if (board[file_of(sq[i]) | r] == pc[i])
+							return false;
+
+				board[sq[i]] = pc[i];
+			}
+
+			const std::string letters = " P  SBRGK";
+			std::ostringstream ss;
+			for (Rank r = RANK_1; r <= RANK_5; ++r)
+			{
+				int empty = 0;
+				for (File f = FILE_5; f >= FILE_1; --f)
+				{
+					Piece p = board[f | r];
+					if (p == NO_PIECE)
+					{
+						++empty;
+						continue;
+					}
+					if (empty)
+						ss << empty, empty = 0;
+					Piece pt = type_of(p);
+					if (pt != KING && (pt & PIECE_PROMOTE))
+						ss << '+', pt = raw_type_of(pt);
+					ss << char(color_of(p) == BLACK ? letters[pt] : tolower(letters[pt]));
+				}
+				if (empty)
+					ss << empty;
+				if (r != RANK_5)
+					ss << '/';
+			}
+
+			ss << " b ";
+			bool anyHand = false;
+			for (Color c : { BLACK, WHITE })
+				for (Piece pt : { ROOK, BISHOP, GOLD, SILVER, PAWN })
+					if (hand[c][pt])
+					{
+						if (hand[c][pt] > 1)
+							ss << hand[c][pt];
+						ss << char(c == BLACK ? letters[pt] : tolower(letters[pt]));
+						anyHand = true;
+					}
+			if (!anyHand)
+				ss << '-';
+			ss << " 1";
+
+			sfen = ss.str();
+			return true;
+		}
+
+		// i番目の駒を、ランダムな場所(盤上か、どちらかの手駒)に置きなおす。
+		void randomize(PRNG& prng, int i)
+		{
+			const Piece raw[] = { PAWN, PAWN, SILVER, SILVER, BISHOP, BISHOP, ROOK, ROOK, GOLD, GOLD };
+			Color c = Color(prng.rand(2));
+			if (i < 2)
+			{
+				sq[i] = Square(prng.rand(SQ_NB));
+				pc[i] = make_piece(Color(i), KING);
+				return;
+			}
+
+			Piece pt = raw[i - 2];
+			if (prng.rand(3) == 0)
+				sq[i] = SQ_NB;
+			else
+			{
+				sq[i] = Square(prng.rand(SQ_NB));
+				if (pt != GOLD && prng.rand(2))
+					pt = Piece(pt + PIECE_PROMOTE);
+			}
+			pc[i] = make_piece(c, pt);
+		}
+	};
+}
+
+// 指し手の数の上界を求め、山登り法で合法手の多い局面を探す。
+// loop : 山登りの回数(ランダムな局面からやりなおす回数)
+void max_moves_cmd(istringstream& is)
+{
+	uint64_t loop_max = 1000;
+	is >> loop_max;
+
+	const int bound = max_moves_upper_bound();
+	cout << "upper bound of generated moves = " << bound << " , MAX_MOVES = " << MAX_MOVES << endl;
+	if (bound > MAX_MOVES)
+		cout << "Error! MAX_MOVES is smaller than the upper bound." << endl;
+
+	// 指し手生成バッファ。上界を超えて生成されても壊れないように十分大きくとっておく。
+	std::vector<ExtMove> buf(1024);
+
+	// posの合法手の数を返す。各指し手生成器が生成する指し手の数の最大値をmaxGeneratedに記録する。
+	int maxGenerated = 0;
+	auto count_moves = [&](const Position& p) {
+		ExtMove* b = buf.data();
+		auto record = [&](ExtMove* end) { maxGenerated = std::max(maxGenerated, int(end - b)); };
+
+		if (p.in_check())
+		{
+			record(generateMoves<EVASIONS_ALL>(p, b));
+			record(generateMoves<EVASIONS>(p, b));
+		}
+		else
+		{
+			record(generateMoves<NON_EVASIONS_ALL>(p, b));
+			record(generateMoves<NON_EVASIONS>(p, b));
+			record(generateMoves<CHECKS_ALL>(p, b));
+			record(generateMoves<QUIET_CHECKS_ALL>(p, b));
+
+			// MovePickerは、捕獲する指し手のあとに、同じバッファに静かな指し手を生成する。
+			record(generateMoves<NON_CAPTURES_PRO_MINUS_ALL>(p, generateMoves<CAPTURES_PRO_PLUS_ALL>(p, b)));
+		}
+
+		ExtMove* end = generateMoves<LEGAL_ALL>(p, b);
+		record(end);
+		return int(end - b);
+	};
+
+	PRNG prng(20201130);
+	Position pos;
+	StateInfo si;
+	int bestCount = 0;
+	std::string bestSfen;
+
+	// 局面として正しければ、合法手の数を返す。正しくなければ-1を返す。
+	auto evaluate = [&](const Placement& pl) {
+		std::string sfen;
+		if (!pl.to_sfen(sfen))
+			return -1;
+		pos.set(sfen, &si, Threads.main());
+
+		// 手番でない側の玉に王手がかかっている局面は正しくない
+		if (pos.effected_to(BLACK, pos.king_square(WHITE)))
+			return -1;
+
+		int n = count_moves(pos);
+		if (n > bestCount)
+			bestCount = n, bestSfen = sfen;
+		return n;
+	};
+
+	for (uint64_t i = 0; i < loop_max; ++i)
+	{
+		Placement cur;
+		int curCount;
+		do {
+			for (int j = 0; j < 12; ++j)
+				cur.randomize(prng, j);
+		} while ((curCount = evaluate(cur)) < 0);
+
+		// 1つの駒を置きなおして、合法手の数が減らなければ採用する。
+		for (int step = 0; step < 10000; ++step)
+		{
+			Placement next = cur;
+			next.randomize(prng, int(prng.rand(12)));
+			int n = evaluate(next);
+			if (n >= curCount)
+				cur = next, curCount = n;
+		}
+
+		if ((i % 100) == 0)
+			cout << ".";
+	}
+
+	cout << endl
+		<< "max legal moves found = " << bestCount << " : sfen " << bestSfen << endl
+		<< "max generated moves = " << maxGenerated << endl;
+	if (maxGenerated > bound)
+		cout << "Error! generated moves exceed the upper bound." << endl;
+}
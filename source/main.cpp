@@ -1,13 +1,23 @@
 ﻿#include "usi.h"
 #include "search.h"
+#include "tt.h"
+#include "thread.h"
+#include "mate.h"
 
 int main(int argc, char* argv[])
 {
   // --- 全体的な初期化
+  USI::init(Options);
   Bitboards::init();
   Position::init();
   Search::init();
+  Threads.set(Options["Threads"]);
+  TT.resize(Options["Hash"]);
+  MateTT.resize(Options["MateHash"]);
 
   // USIコマンドの応答部
   USI::loop(argc, argv);
+
+  // 探索スレッドを終了させる
+  Threads.set(0);
 }
\ No newline at end of file
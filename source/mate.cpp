@@ -0,0 +1,302 @@
+﻿#include <algorithm>
+#include <cstdlib>   // exit()
+#include <cstring>   // std::memset()
+#include <new>       // std::nothrow
+
+#include "mate.h"
+#include "thread.h"
+
+// 詰み探索用の置換表。global object。
+MateHashTable MateTT;
+
+// ----------------------------------
+//        MateHashTable
+// ----------------------------------
+
+MateHashTable::Entry* MateHashTable::probe(Key key, bool& found) const
+{
+	Entry* const e = &table[mul_hi64(key, clusterCount)].entry[0];
+
+	for (int i = 0; i < ClusterSize; ++i)
+		if (e[i].key == key)
+			return found = true, &e[i];
+
+	// 見つからなかったので、置き換えるエントリーを選ぶ。
+	// pn + dnが小さいもの(あまり探索していない局面)ほど置き換えられやすい。
+	// 詰み、不詰みが証明された局面はpn + dnが大きくなるので残りやすい。空のエントリーはpn + dn == 0。
+	Entry* replace = e;
+	for (int i = 1; i < ClusterSize; ++i)
+		if (u64(replace->pn) + replace->dn > u64(e[i].pn) + e[i].dn)
+			replace = &e[i];
+
+	return found = false, replace;
+}
+
+void MateHashTable::resize(size_t mbSize)
+{
+	size_t newClusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
+
+	// 同じサイズなら確保しなおす必要はない。
+	if (newClusterCount == clusterCount)
+		return;
+
+	clusterCount = newClusterCount;
+
+	delete[] table;
+	table = new (std::nothrow) Cluster[clusterCount];
+	if (!table)
+	{
+		std::cout << "info string Error : Failed to allocate " << mbSize
+			<< "MB for mate hash table." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	clear();
+}
+
+void MateHashTable::clear()
+{
+	// 空のエントリーはkey == 0。局面のhash keyが0でない限り、空のエントリーにhitすることはない。
+	std::memset(table, 0, clusterCount * sizeof(Cluster));
+}
+
+// ----------------------------------
+//        df-pn
+// ----------------------------------
+
+namespace {
+
+	// 証明数、反証数の無限大
+	constexpr u32 PN_INF = 100000000;
+
+	// 詰み探索で読む最大手数。これより長い手順の詰みは見つけられない。
+	constexpr int MAX_MATE_PLY = MAX_PLY;
+
+	// 攻め方が後手のときに、局面のhash keyにXORする値。
+	// 同じ局面でも攻め方が異なればpn, dnの意味が変わるので、置換表では別の局面として扱う。
+	// bit0は手番に使われているので立てない。
+	constexpr Key ATTACKER_WHITE_KEY = 0x9e3779b97f4a7c14ULL;
+
+	// df-pnによる詰み探索。
+	// 攻め方の局面(OR node)では王手だけを、受け方の局面(AND node)では回避手だけを生成して、
+	// 証明数(pn)と反証数(dn)が閾値に達するまで、最も有望な子局面を深さ優先で探索する。
+	class DfPn
+	{
+	public:
+		explicit DfPn(Color c) : attacker(c), frames(MAX_MATE_PLY + 1) {}
+
+		// posをpn, dnがそれぞれthpn, thdn以上になるまで探索する。Threads.stopがtrueになったら戻る。
+		void mid(Position& pos, u32 thpn, u32 thdn, int ply);
+
+		// 置換表からkeyに対応する局面のpn, dnを取り出す。
+		// 登録されていない局面は(1, 1)、keyが0(千日手などで詰まないものとして扱う局面)なら(PN_INF, 0)とする。
+		void get(Key key, u32& pn, u32& dn) const;
+
+		// 置換表を辿って、詰み手順をpvに格納する。取り出せなかったらfalseを返す。
+		bool get_pv(Position& pos, std::vector<Move>& pv);
+
+		// 置換表で用いる局面のhash key
+		Key key_of(const Position& pos) const { return pos.key() ^ (attacker == WHITE ? ATTACKER_WHITE_KEY : 0); }
+
+	private:
+		// 置換表にpn, dnを格納する。
+		void store(Key key, u32 pn, u32 dn);
+
+		// posの合法な王手(攻め方)か回避手(受け方)を生成してframes[ply]に格納し、その数を返す。
+		// 千日手になる指し手と、最大手数を超える指し手は、その先の局面のkeyを0にしておく。
+		int generate(Position& pos, int ply);
+
+		// 攻め方
+		Color attacker;
+
+		// plyごとの指し手と、その指し手で進めた局面のkey。
+		// 再帰呼び出しのたびにstackに確保すると大きいので、探索開始時にまとめて確保しておく。
+		struct Frame {
+			ExtMove moves[MAX_MOVES];
+			Key keys[MAX_MOVES];
+		};
+		std::vector<Frame> frames;
+	};
+
+	void DfPn::get(Key key, u32& pn, u32& dn) const
+	{
+		if (key == 0)
+		{
+			pn = PN_INF, dn = 0;
+			return;
+		}
+
+		bool found;
+		const MateHashTable::Entry* e = MateTT.probe(key, found);
+		if (found)
+			pn = e->pn, dn = e->dn;
+		else
+			pn = dn = 1;
+	}
+
+	void DfPn::store(Key key, u32 pn, u32 dn)
+	{
+		bool found;
+		MateHashTable::Entry* e = MateTT.probe(key, found);
+		e->key = key;
+		e->pn = pn;
+		e->dn = dn;
+	}
+
+	int DfPn::generate(Position& pos, int ply)
+	{
+		Frame& f = frames[ply];
+		ExtMove* end = pos.side_to_move() == attacker ? generateMoves<CHECKS_ALL>(pos, f.moves)
+		                                              : generateMoves<EVASIONS_ALL>(pos, f.moves);
+		StateInfo si;
+		int n = 0;
+		for (ExtMove* m = f.moves; m < end; ++m)
+		{
+			if (!pos.legal(*m))
+				continue;
+
+			const Move move = *m;
+			pos.do_move(move, si);
+			f.keys[n] = (ply + 1 >= MAX_MATE_PLY || pos.is_repetition() != REPETITION_NONE) ? 0 : key_of(pos);
+			pos.undo_move(move);
+			f.moves[n++].move = move;
+		}
+		return n;
+	}
+
+	void DfPn::mid(Position& pos, u32 thpn, u32 thdn, int ply)
+	{
+		// go mateではmain threadが詰み探索を行うので、指定された時間に達していれば探索を終了させる
+		if (pos.this_thread() == Threads.main())
+			Threads.main()->check_time();
+
+		const bool orNode = pos.side_to_move() == attacker;
+		const Key key = key_of(pos);
+		const int n = generate(pos, ply);
+		const Frame& f = frames[ply];
+
+		// 攻め方に王手がなければ不詰み、受け方に回避手がなければ詰み
+		if (n == 0)
+		{
+			store(key, orNode ? PN_INF : 0, orNode ? 0 : PN_INF);
+			return;
+		}
+
+		StateInfo si;
+		while (true)
+		{
+			// 子局面のpn, dnから、この局面のpn, dnを求める。
+			// 攻め方の局面 : pn = 子のpnの最小値, dn = 子のdnの和
+			// 受け方の局面 : pn = 子のpnの和,     dn = 子のdnの最小値
+			// 最小値をとった子(best)と、2番目に小さい値(second)も求めておく。
+			u32 pn = orNode ? PN_INF : 0, dn = orNode ? 0 : PN_INF;
+			u32 second = PN_INF, bestPn = 0, bestDn = 0;
+			int best = 0;
+			for (int i = 0; i < n; ++i)
+			{
+				u32 cpn, cdn;
+				get(f.keys[i], cpn, cdn);
+
+				if (orNode)
+				{
+					if (cpn < pn)
+						second = pn, pn = cpn, bestDn = cdn, best = i;
+					else if (cpn < second)
+						second = cpn;
+					dn = std::min(dn + cdn, PN_INF);
+				}
+				else
+				{
+					if (cdn < dn)
+						second = dn, dn = cdn, bestPn = cpn, best = i;
+					else if (cdn < second)
+						second = cdn;
+					pn = std::min(pn + cpn, PN_INF);
+				}
+			}
+
+			store(key, pn, dn);
+
+			if (pn >= thpn || dn >= thdn || Threads.stop)
+				return;
+
+			// 最も有望な子局面を、この局面の閾値を超えない範囲で、2番目に有望な子局面を上回るまで探索する。
+			u32 cthpn, cthdn;
+			if (orNode)
+				cthpn = std::min(thpn, second + 1), cthdn = thdn - dn + bestDn;
+			else
+				cthpn = thpn - pn + bestPn, cthdn = std::min(thdn, second + 1);
+
+			const Move move = f.moves[best];
+			pos.do_move(move, si);
+			mid(pos, cthpn, cthdn, ply + 1);
+			pos.undo_move(move);
+		}
+	}
+
+	bool DfPn::get_pv(Position& pos, std::vector<Move>& pv)
+	{
+		std::vector<StateInfo> states(MAX_MATE_PLY);
+		bool mated = false;
+
+		for (int ply = 0; ply < MAX_MATE_PLY; ++ply)
+		{
+			const int n = generate(pos, ply);
+
+			// 受け方に回避手がなければ詰み
+			if (n == 0)
+			{
+				mated = pos.side_to_move() != attacker;
+				break;
+			}
+
+			// 詰みが証明されている子局面を選ぶ。
+			auto proven_child = [&]() {
+				for (int i = 0; i < n; ++i)
+				{
+					u32 cpn, cdn;
+					get(frames[ply].keys[i], cpn, cdn);
+					if (cpn == 0)
+						return i;
+				}
+				return -1;
+			};
+
+			// 置換表から消えていたら、この局面から証明しなおす。
+			int best = proven_child();
+			if (best < 0)
+			{
+				mid(pos, PN_INF, PN_INF, ply);
+				best = proven_child();
+			}
+			if (best < 0)
+				break;
+
+			const Move move = frames[ply].moves[best];
+			pv.push_back(move);
+			pos.do_move(move, states[ply]);
+		}
+
+		// 局面を元に戻す
+		for (auto it = pv.rbegin(); it != pv.rend(); ++it)
+			pos.undo_move(*it);
+
+		return mated;
+	}
+}
+
+Mate::Result Mate::search(Position& pos, std::vector<Move>& pv)
+{
+	DfPn dfpn(pos.side_to_move());
+	dfpn.mid(pos, PN_INF, PN_INF, 0);
+
+	u32 pn, dn;
+	dfpn.get(dfpn.key_of(pos), pn, dn);
+
+	pv.clear();
+	if (pn == 0 && dfpn.get_pv(pos, pv))
+		return MATE;
+
+	pv.clear();
+	return dn == 0 ? NO_MATE : UNKNOWN;
+}
@@ -0,0 +1,72 @@
+﻿#ifndef _MATE_H_
+#define _MATE_H_
+
+#include <vector>
+
+#include "position.h"
+
+// --------------------
+//  詰み探索用の置換表
+// --------------------
+
+// df-pnの証明数(pn)と反証数(dn)を局面ごとに保持する置換表。通常探索の置換表(TT)とは別に持つ。
+// 詰み探索を行うのは同時に1スレッドだけなので、排他制御はしない。
+struct MateHashTable
+{
+	// 置換表のエントリー。16byte。
+	// pn, dnは攻め方から見た値。pn == 0なら詰み、dn == 0なら不詰みが証明されている。
+	struct Entry
+	{
+		Key key;
+		u32 pn, dn;
+	};
+
+	// keyに対応するエントリーを返す。見つからなければfoundにfalseを設定し、置き換えるべきエントリーを返す。
+	Entry* probe(Key key, bool& found) const;
+
+	// 置換表のサイズを変更する。mbSize : 確保するメモリサイズ。MB単位。
+	void resize(size_t mbSize);
+
+	// 置換表のエントリーの全クリア
+	void clear();
+
+	~MateHashTable() { delete[] table; }
+
+private:
+	static constexpr int ClusterSize = 4;
+
+	struct alignas(64) Cluster {
+		Entry entry[ClusterSize];
+	};
+
+	static_assert(sizeof(Cluster) == 64, "Cluster size incorrect");
+
+	// 確保されているClusterの数
+	size_t clusterCount = 0;
+
+	// 置換表本体
+	Cluster* table = nullptr;
+};
+
+extern MateHashTable MateTT;
+
+// --------------------
+//   詰み探索(df-pn)
+// --------------------
+
+namespace Mate
+{
+	// 詰み探索の結果
+	enum Result {
+		MATE,    // 詰み
+		NO_MATE, // 不詰み
+		UNKNOWN, // 探索を打ち切ったので不明
+	};
+
+	// posの手番側(攻め方)が王手の連続で相手玉を詰ませられるかをdf-pnで調べる。
+	// 詰みであれば、pvに詰みまでの手順を格納する。
+	// Threads.stopがtrueになったら探索を打ち切ってUNKNOWNを返す。
+	Result search(Position& pos, std::vector<Move>& pv);
+}
+
+#endif // _MATE_H_
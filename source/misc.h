@@ -43,6 +43,27 @@ static TimePoint now()
 }
 
 
+// --------------------
+//    64bit乗算の上位
+// --------------------
+
+// a * b の128bitの結果の上位64bitを返す。
+// 置換表のindexの計算などで、keyを[0,b)の範囲に写像するのに使う。
+inline u64 mul_hi64(u64 a, u64 b)
+{
+#if defined(__GNUC__) && defined(IS_64BIT)
+	__extension__ typedef unsigned __int128 u128;
+	return ((u128)a * (u128)b) >> 64;
+#else
+	u64 aL = (u32)a, aH = a >> 32;
+	u64 bL = (u32)b, bH = b >> 32;
+	u64 c1 = (aL * bL) >> 32;
+	u64 c2 = aH * bL + c1;
+	u64 c3 = aL * bH + (u32)c2;
+	return aH * bH + (c2 >> 32) + (c3 >> 32);
+#endif
+}
+
 // --------------------
 //       乱数
 // --------------------
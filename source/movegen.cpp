@@ -1,6 +1,7 @@
 ﻿// 指し手生成ライブラリ
 
 #include "position.h"
+#include "perfstat.h"
 
 #include <iostream>
 using namespace std;
@@ -760,6 +761,8 @@ ExtMove* generateChecksMoves(const Position& pos, ExtMove* mlist)
 template<MOVE_GEN_TYPE GenType>
 ExtMove* generateMoves(const Position& pos, ExtMove* mlist, Square recapSq)
 {
+	PERF_REGION(MOVEGEN);
+
 	// 歩の不成などを含め、すべての指し手を生成するのか。
 	// GenTypeの末尾に"ALL"とついているものがその対象。
 	const bool All = (GenType == EVASIONS_ALL) || (GenType == CHECKS_ALL) || (GenType == LEGAL_ALL)
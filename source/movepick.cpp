@@ -0,0 +1,236 @@
+﻿#include <algorithm>
+#include <iterator>
+
+#include "movepick.h"
+#include "evaluate.h"
+#include "thread.h"
+
+namespace {
+
+	// MovePickerの段階
+	enum Stages {
+		// 通常探索
+		MAIN_TT, CAPTURE_INIT, GOOD_CAPTURE, REFUTATION, QUIET_INIT, QUIET, BAD_CAPTURE,
+
+		// 王手がかかっているとき
+		EVASION_TT, EVASION_INIT, EVASION,
+
+		// 静止探索
+		QSEARCH_TT, QCAPTURE_INIT, QCAPTURE,
+	};
+
+	// beginからendまでの指し手のうち、スコアがlimit以上のものをスコアの降順に並べて先頭に集める。
+	// 残りの指し手の順番は保証されない。
+	void partial_insertion_sort(ExtMove* begin, ExtMove* end, int limit)
+	{
+		for (ExtMove* sortedEnd = begin, *p = begin + 1; p < end; ++p)
+			if (p->value >= limit)
+			{
+				ExtMove tmp = *p, *q;
+				*p = *++sortedEnd;
+				for (q = sortedEnd; q != begin && *(q - 1) < tmp; --q)
+					*q = *(q - 1);
+				*q = tmp;
+			}
+	}
+
+	// 捕獲する指し手で得られる駒の価値(MVV)。
+	// 成りの指し手は、成ることによる駒の価値の上昇分も加える。
+	int mvv(const Position& pos, Move m)
+	{
+		const Piece moved = type_of(pos.piece_on(move_from(m)));
+
+		return Eval::PieceValue[type_of(pos.piece_on(move_to(m)))]
+			+ (is_promote(m) ? Eval::PieceValue[moved + PIECE_PROMOTE] - Eval::PieceValue[moved] : 0);
+	}
+}
+
+// 通常探索(search)から呼び出されるとき用
+MovePicker::MovePicker(const Position& pos_, Move ttm, int d, const ButterflyHistory* mh, const CapturePieceToHistory* cph,
+	const PieceToHistory** ch, Move cm, const Move* killers)
+	: pos(pos_), mainHistory(mh), captureHistory(cph), continuationHistory(ch),
+	refutations{ { killers[0], 0 }, { killers[1], 0 }, { cm, 0 } }, depth(d),
+	moves(pos_.this_thread()->acquire_moves())
+{
+	ASSERT_LV3(d > 0);
+
+	stage = pos.in_check() ? EVASION_TT : MAIN_TT;
+	ttMove = ttm && pos.pseudo_legal(ttm) ? ttm : MOVE_NONE;
+	stage += (ttMove == MOVE_NONE);
+}
+
+// 静止探索(qsearch)から呼び出されるとき用
+MovePicker::MovePicker(const Position& pos_, Move ttm, const ButterflyHistory* mh, const CapturePieceToHistory* cph,
+	const PieceToHistory** ch, Square recapSq)
+	: pos(pos_), mainHistory(mh), captureHistory(cph), continuationHistory(ch), recaptureSquare(recapSq), depth(0),
+	moves(pos_.this_thread()->acquire_moves())
+{
+	stage = pos.in_check() ? EVASION_TT : QSEARCH_TT;
+
+	// 王手がかかっていないときは、recaptureの指し手しか生成しないので、置換表の指し手もそれに限る。
+	ttMove = ttm
+		&& (pos.in_check() || move_to(ttm) == recaptureSquare)
+		&& pos.pseudo_legal(ttm) ? ttm : MOVE_NONE;
+	stage += (ttMove == MOVE_NONE);
+}
+
+MovePicker::~MovePicker()
+{
+	pos.this_thread()->release_moves(moves);
+}
+
+// 生成した指し手にオーダリング用のスコアをつける。
+// CAPTURES     : MVV + capture history
+// NON_CAPTURES : butterfly history + 1手前、2手前の指し手とのcontinuation history
+// EVASIONS     : 捕獲する指し手はMVVで、それ以外の指し手よりも先に。それ以外はbutterfly history + continuation history。
+template <MOVE_GEN_TYPE GenType>
+void MovePicker::score()
+{
+	static_assert(GenType == CAPTURES || GenType == NON_CAPTURES || GenType == EVASIONS, "Wrong type");
+
+	const Color us = pos.side_to_move();
+
+	for (ExtMove* m = cur; m < endMoves; ++m)
+	{
+		const Piece pc = pos.moved_piece_after(*m);
+		const Square to = move_to(*m);
+
+		if (GenType == CAPTURES)
+			m->value = mvv(pos, *m) * 6
+				+ (*captureHistory)[pc][to][type_of(pos.piece_on(to))];
+
+		else if (GenType == NON_CAPTURES)
+			m->value = (*mainHistory)[us][from_to(*m)]
+				+ (*continuationHistory[0])[pc][to]
+				+ (*continuationHistory[1])[pc][to];
+
+		else // GenType == EVASIONS
+		{
+			if (pos.capture(*m))
+				m->value = mvv(pos, *m) - (int)type_of(pos.piece_on(move_from(*m))) + (1 << 28);
+			else
+				m->value = (*mainHistory)[us][from_to(*m)]
+					+ (*continuationHistory[0])[pc][to];
+		}
+	}
+}
+
+template <PickType T, typename Pred>
+Move MovePicker::select(Pred filter)
+{
+	while (cur < endMoves)
+	{
+		if (T == Best)
+			std::swap(*cur, *std::max_element(cur, endMoves));
+
+		if (cur->move != ttMove && filter())
+			return *cur++;
+
+		cur++;
+	}
+	return MOVE_NONE;
+}
+
+// 次の指し手を返す。指し手が尽きたらMOVE_NONEを返す。
+// skipQuiets : trueなら静かな指し手(killer, counter moveを含む)を返さない。
+Move MovePicker::nextMove(bool skipQuiets)
+{
+top:
+	switch (stage)
+	{
+	// 置換表の指し手を返す
+	case MAIN_TT:
+	case EVASION_TT:
+	case QSEARCH_TT:
+		++stage;
+		return ttMove;
+
+	// 捕獲する指し手を生成する
+	case CAPTURE_INIT:
+	case QCAPTURE_INIT:
+		cur = endBadCaptures = moves;
+		endMoves = stage == CAPTURE_INIT ? generateMoves<CAPTURES_PRO_PLUS>(pos, cur)
+			                             : generateMoves<RECAPTURES>(pos, cur, recaptureSquare);
+
+		score<CAPTURES>();
+		++stage;
+		goto top;
+
+	// 良い捕獲を返す。悪い捕獲はmovesの先頭に詰めておいて最後に返す。
+	// SEEで駒損しないものを良い捕獲とする。ただし、オーダリングのスコアが高いものは多少の駒損を許容する。
+	case GOOD_CAPTURE:
+		if (select<Best>([&]() {
+				return pos.see_ge(*cur, Value(-55 * cur->value / 1024)) ? true : (*endBadCaptures++ = *cur, false); }))
+			return *(cur - 1);
+
+		// killerとcounter moveの準備。counter moveがkillerと同じなら重複して返さないようにする。
+		cur = std::begin(refutations);
+		endMoves = std::end(refutations);
+
+		if (refutations[0].move == refutations[2].move
+			|| refutations[1].move == refutations[2].move)
+			--endMoves;
+
+		++stage;
+		[[fallthrough]];
+
+	// killerとcounter moveを返す。
+	// 他の局面での指し手なので、この局面で擬似合法手であるかを確認する。捕獲する指し手は返したあとなので除外する。
+	case REFUTATION:
+		if (!skipQuiets && select<Next>([&]() { return cur->move != MOVE_NONE
+				&& !pos.capture_or_pawn_promotion(*cur)
+				&& pos.pseudo_legal(*cur); }))
+			return *(cur - 1);
+
+		++stage;
+		[[fallthrough]];
+
+	// 静かな指し手を生成する
+	case QUIET_INIT:
+		if (!skipQuiets)
+		{
+			cur = endBadCaptures;
+			endMoves = generateMoves<NON_CAPTURES_PRO_MINUS>(pos, cur);
+
+			score<NON_CAPTURES>();
+			partial_insertion_sort(cur, endMoves, -3000 * depth);
+		}
+
+		++stage;
+		[[fallthrough]];
+
+	// 静かな指し手を返す。killerとcounter moveは返したあとなので除外する。
+	case QUIET:
+		if (!skipQuiets && select<Next>([&]() { return cur->move != refutations[0].move
+				&& cur->move != refutations[1].move
+				&& cur->move != refutations[2].move; }))
+			return *(cur - 1);
+
+		// 悪い捕獲の準備
+		cur = moves;
+		endMoves = endBadCaptures;
+
+		++stage;
+		[[fallthrough]];
+
+	// 悪い捕獲を返す
+	case BAD_CAPTURE:
+		return select<Next>([]() { return true; });
+
+	// 王手の回避手を生成する
+	case EVASION_INIT:
+		cur = moves;
+		endMoves = generateMoves<EVASIONS>(pos, cur);
+
+		score<EVASIONS>();
+		++stage;
+		[[fallthrough]];
+
+	case EVASION:
+	case QCAPTURE:
+		return select<Best>([]() { return true; });
+	}
+
+	ASSERT_LV1(false);
+	return MOVE_NONE;
+}
@@ -0,0 +1,155 @@
+﻿#ifndef _MOVEPICK_H_
+#define _MOVEPICK_H_
+
+#include <array>
+#include <limits>
+#include <type_traits>
+
+#include "position.h"
+
+// --------------------
+//   history table
+// --------------------
+
+// history tableの1つの要素。
+// operator<<でbonusを加算すると、値が[-D, D]の範囲に収まるように、
+// 現在の値が大きいほど加算される量が小さくなる。(gravity)
+template <typename T, int D>
+class StatsEntry
+{
+	T entry;
+
+public:
+	void operator=(const T& v) { entry = v; }
+	T* operator&() { return &entry; }
+	T* operator->() { return &entry; }
+	operator const T& () const { return entry; }
+
+	void operator<<(int bonus)
+	{
+		ASSERT_LV3(abs(bonus) <= D);
+		static_assert(D <= std::numeric_limits<T>::max(), "D overflows T");
+
+		entry += bonus - entry * abs(bonus) / D;
+
+		ASSERT_LV3(abs(entry) <= D);
+	}
+};
+
+// 多次元のhistory table。
+// 例えば、Stats<s16, D, 2, 3>は、s16型の2 x 3の配列で、各要素はStatsEntry<s16, D>である。
+template <typename T, int D, int Size, int... Sizes>
+struct Stats : public std::array<Stats<T, D, Sizes...>, Size>
+{
+	// すべての要素をvにする。
+	void fill(const T& v)
+	{
+		// 多次元配列であっても、要素は連続したメモリに並んでいる。
+		static_assert(std::is_standard_layout<Stats>::value, "Stats is not standard layout");
+		T* p = reinterpret_cast<T*>(this);
+		std::fill(p, p + sizeof(*this) / sizeof(T), v);
+	}
+};
+
+template <typename T, int D, int Size>
+struct Stats<T, D, Size> : public std::array<StatsEntry<T, D>, Size> {};
+
+// StatsEntryのDとして使う。operator<<を使わないtableであることを意味する。
+enum StatsParams { NOT_USED = 0 };
+
+// 静かな指し手(駒を取らない指し手)の履歴。[手番][from_to]
+// beta cutoffを起こした指し手ほど大きな値になる。
+typedef Stats<s16, 10692, COLOR_NB, FROM_TO_NB> ButterflyHistory;
+
+// 直前の指し手の[移動後の駒][移動先]に対して、beta cutoffを起こした応手(counter move)
+typedef Stats<Move, NOT_USED, PIECE_NB, SQ_NB> CounterMoveHistory;
+
+// 駒を捕獲する指し手の履歴。[移動後の駒][移動先][捕獲した駒の種類]
+typedef Stats<s16, 10692, PIECE_NB, SQ_NB, PIECE_TYPE_NB> CapturePieceToHistory;
+
+// 指し手の[移動後の駒][移動先]による履歴。ContinuationHistoryの要素として使う。
+typedef Stats<s16, 29952, PIECE_NB, SQ_NB> PieceToHistory;
+
+// 1手前、2手前の指し手の[移動後の駒][移動先]と、現在の指し手の[移動後の駒][移動先]の組み合わせによる履歴。
+// 探索中は、Search::Stack::continuationHistoryに、1手前、2手前の指し手に対応するPieceToHistoryへのポインタを
+// 保持しておいて、それを使う。
+typedef Stats<PieceToHistory, NOT_USED, PIECE_NB, SQ_NB> ContinuationHistory;
+
+// --------------------
+//   指し手オーダリング
+// --------------------
+
+// MovePicker::select()で指し手を選ぶ方法
+// Next : 並んでいる順に返す, Best : 残りのなかで最もスコアの高いものを返す
+enum PickType { Next, Best };
+
+// 指し手を段階的に生成して、良さそうな順に1手ずつ返す。
+// 先に返した指し手でbeta cutoffが起きれば、残りの指し手は生成しなくて済む。
+//
+// 通常探索 : 置換表の指し手 → 良い捕獲 → killer, counter move → 静かな指し手 → 悪い捕獲
+// 静止探索 : 置換表の指し手 → recapture
+// 王手がかかっているときは、置換表の指し手 → 回避手
+//
+// 返す指し手は擬似合法手(pseudo-legal)なので、do_move()の前にPosition::legal()で確認すること。
+class MovePicker
+{
+public:
+	MovePicker(const MovePicker&) = delete;
+	MovePicker& operator=(const MovePicker&) = delete;
+
+	// 通常探索(search)から呼び出されるとき用
+	// ch      : 1手前、2手前の指し手に対応するPieceToHistory
+	// killers : killer move 2手
+	// cm      : counter move
+	MovePicker(const Position& pos_, Move ttm, int d, const ButterflyHistory* mh, const CapturePieceToHistory* cph,
+		const PieceToHistory** ch, Move cm, const Move* killers);
+
+	// 静止探索(qsearch)から呼び出されるとき用
+	// recapSq : 直前の指し手の移動先。この升への指し手だけを生成する。
+	MovePicker(const Position& pos_, Move ttm, const ButterflyHistory* mh, const CapturePieceToHistory* cph,
+		const PieceToHistory** ch, Square recapSq);
+
+	// 借りていた指し手生成バッファをスレッドに返す。
+	~MovePicker();
+
+	// 次の指し手を返す。指し手が尽きたらMOVE_NONEを返す。
+	// skipQuiets : trueなら静かな指し手(killer, counter moveを含む)を返さない。
+	Move nextMove(bool skipQuiets = false);
+
+private:
+	// 生成した指し手にオーダリング用のスコアをつける。
+	template <MOVE_GEN_TYPE GenType> void score();
+
+	// cur以降の指し手からPickTypeに従って1手選んで返す。
+	// 置換表の指し手とfilterを満たさない指し手は飛ばす。指し手が尽きたらMOVE_NONEを返す。
+	template <PickType T, typename Pred> Move select(Pred filter);
+
+	const Position& pos;
+	const ButterflyHistory* mainHistory;
+	const CapturePieceToHistory* captureHistory;
+	const PieceToHistory** continuationHistory;
+
+	// 置換表の指し手
+	Move ttMove;
+
+	// killer 2手 + counter move
+	ExtMove refutations[3];
+
+	// cur : 次に返す指し手, endMoves : 生成した指し手の末尾
+	// endBadCaptures : 後回しにした悪い捕獲の末尾(movesの先頭から詰めて格納する)
+	ExtMove* cur, * endMoves, * endBadCaptures;
+
+	// 現在の段階
+	int stage;
+
+	// 静止探索でrecaptureを生成する升
+	Square recaptureSquare;
+
+	// 残り探索深さ
+	int depth;
+
+	// 指し手生成バッファ。MAX_MOVES個の要素をスレッドの指し手生成バッファ(Thread::moveBuffer)から借りる。
+	ExtMove* moves;
+};
+
+#endif // _MOVEPICK_H_
@@ -0,0 +1,287 @@
+﻿#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "perfstat.h"
+
+#if defined(USE_PERF_STAT)
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace PerfStat
+{
+	namespace {
+
+		// 区間の名前。"perfstat regions"の引数と出力に用いる。
+		const char* RegionNames[REGION_NB] = { "search", "movegen", "do_move", "eval" };
+
+		// イベントの名前と、perf_event_open()に渡す種類と設定
+		struct EventDesc {
+			const char* name;
+			u32 type;
+			u64 config;
+		};
+
+		const EventDesc Events[EVENT_NB] = {
+			{ "cycles",         PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+			{ "instructions",   PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+			{ "L1D-misses",     PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+				| (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+			{ "LLC-misses",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+			{ "branch-misses",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+			{ "task-clock[ms]", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+		};
+
+		// 計測する区間のbit mask
+		std::atomic<u32> activeRegions((1u << REGION_NB) - 1);
+
+		// いずれかのスレッドで開けたイベントのbit mask
+		std::atomic<u32> openedEvents(0);
+
+		// 区間ごとの計測結果
+		struct Totals
+		{
+			u64 value[REGION_NB][EVENT_NB];
+			u64 calls[REGION_NB];
+
+			void clear() { std::memset(this, 0, sizeof(*this)); }
+
+			void add(const Totals& t)
+			{
+				for (int r = 0; r < REGION_NB; ++r)
+				{
+					for (int e = 0; e < EVENT_NB; ++e)
+						value[r][e] += t.value[r][e];
+					calls[r] += t.calls[r];
+				}
+			}
+		};
+
+		// 生存中のスレッドのカウンタと、終了したスレッドの計測結果の合計
+		std::mutex countersMutex;
+		std::vector<ThreadCounters*> liveCounters;
+		Totals retiredTotals;
+	}
+
+	// スレッドごとのカウンタ。スレッドが最初に区間に入ったときに、そのスレッドのイベントを開く。
+	// 開けたイベントを1つのgroupにまとめて、1回のread()ですべての値を読む。
+	struct ThreadCounters
+	{
+		ThreadCounters();
+		~ThreadCounters();
+
+		// 開けたイベントの現在の値をvに読む。開けなかったイベントは0。
+		void read(u64* v) const;
+
+		// groupのleaderのfd。ひとつも開けなければ-1。
+		int leader = -1;
+
+		// 開けたイベントのfd(開けなかったイベントは-1)と、その数
+		int fd[EVENT_NB];
+		int count = 0;
+
+		// read()で読んだ値の並びでの、各イベントの位置
+		int index[EVENT_NB];
+
+		// 区間ごとの入れ子の深さ
+		int depth[REGION_NB] = {};
+
+		Totals totals;
+	};
+
+	ThreadCounters::ThreadCounters()
+	{
+		totals.clear();
+
+		for (int e = 0; e < EVENT_NB; ++e)
+		{
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = Events[e].type;
+			attr.config = Events[e].config;
+			attr.read_format = PERF_FORMAT_GROUP;
+
+			// このスレッドのuser空間だけを計測する。(perf_event_paranoid == 2でも使える)
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+
+			fd[e] = int(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+			if (fd[e] < 0)
+			{
+				index[e] = -1;
+				continue;
+			}
+
+			if (leader < 0)
+				leader = fd[e];
+			index[e] = count++;
+			openedEvents |= 1u << e;
+		}
+
+		std::lock_guard<std::mutex> lk(countersMutex);
+		liveCounters.push_back(this);
+	}
+
+	ThreadCounters::~ThreadCounters()
+	{
+		{
+			std::lock_guard<std::mutex> lk(countersMutex);
+			liveCounters.erase(std::find(liveCounters.begin(), liveCounters.end(), this));
+			retiredTotals.add(totals);
+		}
+
+		for (int e = 0; e < EVENT_NB; ++e)
+			if (fd[e] >= 0)
+				close(fd[e]);
+	}
+
+	void ThreadCounters::read(u64* v) const
+	{
+		// PERF_FORMAT_GROUPでは、{ イベントの数, 値[イベントの数] }が返る。
+		u64 buf[1 + EVENT_NB] = {};
+		if (leader >= 0 && ::read(leader, buf, sizeof(u64) * (1 + count)) < 0)
+			std::memset(buf, 0, sizeof(buf));
+
+		for (int e = 0; e < EVENT_NB; ++e)
+			v[e] = index[e] >= 0 ? buf[1 + index[e]] : 0;
+	}
+
+	namespace {
+
+		// このスレッドのカウンタ
+		ThreadCounters& thread_counters()
+		{
+			thread_local ThreadCounters counters;
+			return counters;
+		}
+	}
+
+	Scope::Scope(Region r) : region(r), counters(nullptr)
+	{
+		if (!(activeRegions.load(std::memory_order_relaxed) & (1u << r)))
+			return;
+
+		counters = &thread_counters();
+		if (counters->depth[r]++ == 0)
+			counters->read(start);
+	}
+
+	Scope::~Scope()
+	{
+		if (!counters || --counters->depth[region] != 0)
+			return;
+
+		u64 now[EVENT_NB];
+		counters->read(now);
+
+		Totals& t = counters->totals;
+		for (int e = 0; e < EVENT_NB; ++e)
+			t.value[region][e] += now[e] - start[e];
+		++t.calls[region];
+	}
+
+	// 計測結果を出力する。探索中でないときに呼び出すこと。
+	static void print()
+	{
+		Totals sum;
+		{
+			std::lock_guard<std::mutex> lk(countersMutex);
+			sum = retiredTotals;
+			for (ThreadCounters* c : liveCounters)
+				sum.add(c->totals);
+		}
+
+		const u32 opened = openedEvents.load();
+		std::ostringstream ss;
+
+		ss << "info string perfstat events";
+		for (int e = 0; e < EVENT_NB; ++e)
+			ss << ' ' << Events[e].name << ((opened & (1u << e)) ? "" : "(unavailable)");
+		ss << std::endl;
+
+		for (int r = 0; r < REGION_NB; ++r)
+		{
+			if (!(activeRegions.load() & (1u << r)))
+				continue;
+
+			const u64* v = sum.value[r];
+			ss << "info string perfstat " << RegionNames[r] << " calls " << sum.calls[r];
+			for (int e = 0; e < EVENT_NB; ++e)
+			{
+				if (!(opened & (1u << e)))
+					continue;
+
+				ss << ' ' << Events[e].name << ' ';
+				if (e == TASK_CLOCK)
+					ss << v[e] / 1000000;
+				else
+					ss << v[e];
+			}
+
+			// 1 cycleあたりの命令数
+			if ((opened & (1u << CYCLES)) && (opened & (1u << INSTRUCTIONS)) && v[CYCLES])
+				ss << " ipc " << std::fixed << std::setprecision(2) << double(v[INSTRUCTIONS]) / v[CYCLES];
+
+			ss << std::endl;
+		}
+
+		std::cout << ss.str() << std::flush;
+	}
+
+	// 計測結果をclearする。探索中でないときに呼び出すこと。
+	static void clear()
+	{
+		std::lock_guard<std::mutex> lk(countersMutex);
+		retiredTotals.clear();
+		for (ThreadCounters* c : liveCounters)
+			c->totals.clear();
+	}
+
+	void perfstat_cmd(std::istringstream& is)
+	{
+		std::string token;
+		is >> token;
+
+		if (token.empty())
+			print();
+
+		else if (token == "clear")
+			clear();
+
+		else if (token == "regions")
+		{
+			u32 mask = 0;
+			while (is >> token)
+				for (int r = 0; r < REGION_NB; ++r)
+					if (token == RegionNames[r])
+						mask |= 1u << r;
+
+			activeRegions = mask;
+			clear();
+		}
+
+		else
+			std::cout << "info string Error! unknown perfstat command : " << token << std::endl;
+	}
+}
+
+#else
+
+namespace PerfStat
+{
+	void perfstat_cmd(std::istringstream&)
+	{
+		std::cout << "info string perfstat is not available. define USE_PERF_STAT in config.h (Linux only)." << std::endl;
+	}
+}
+
+#endif
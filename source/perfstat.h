@@ -0,0 +1,67 @@
+﻿#ifndef _PERFSTAT_H_
+#define _PERFSTAT_H_
+
+#include <iosfwd>
+
+#include "types.h"
+
+// --------------------
+//  ハードウェアカウンタ
+// --------------------
+
+// Linuxのperf_event_open()で、探索、指し手生成、do_move()、評価関数の各区間で費やした
+// cycle数、命令数、L1Dキャッシュミス、LLCミス、分岐予測ミス(とCPU時間)を計測する。
+// NPSだけではわからない性能の変化が、どの部分で起きているかを外部のprofilerなしに調べるのに用いる。
+//
+// config.hでUSE_PERF_STATをdefineしたときだけ計測のコードが生成される。(Linuxのみ)
+// 結果はUSIの拡張コマンド"perfstat"で出力する。
+//
+// カウンタは区間の出入りのたびにread()で読むので、外側の区間(探索)の値には内側の区間の計測の負荷も含まれる。
+// 外側の区間を正しく計りたいときは、"perfstat regions search"のように計測する区間を絞ること。
+namespace PerfStat
+{
+	// 計測する区間
+	enum Region { SEARCH, MOVEGEN, DO_MOVE, EVALUATE, REGION_NB };
+
+	// 計測するイベント
+	enum Event { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCH_MISSES, TASK_CLOCK, EVENT_NB };
+
+	// スレッドごとのカウンタ。perfstat.cppで定義する。
+	struct ThreadCounters;
+
+	// 区間の入口で生成し、出口で破棄する。その間のカウンタの増分を、スレッドごとに区間別に加算する。
+	// 同じ区間が入れ子になったとき(再帰呼び出しなど)は、いちばん外側だけを計測する。
+	class Scope
+	{
+	public:
+		explicit Scope(Region r);
+		~Scope();
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		Region region;
+
+		// 計測しない区間であればnullptr
+		ThreadCounters* counters;
+
+		// 区間の入口でのカウンタの値
+		u64 start[EVENT_NB];
+	};
+
+	// USIの拡張コマンド"perfstat"
+	// perfstat                   : 前回clearしてからの計測結果を出力する。
+	// perfstat clear             : 計測結果をclearする。
+	// perfstat regions <区間...> : 計測する区間(search, movegen, do_move, eval)を指定して、計測結果をclearする。
+	void perfstat_cmd(std::istringstream& is);
+}
+
+// 関数の先頭などに書くと、そのscopeを区間rとして計測する。USE_PERF_STATがdefineされていなければ何も生成しない。
+#if defined(USE_PERF_STAT)
+#define PERF_REGION(r) PerfStat::Scope perfScope_(PerfStat::r)
+#else
+#define PERF_REGION(r)
+#endif
+
+#endif // _PERFSTAT_H_
@@ -1,5 +1,7 @@
 ﻿//#include "position.h"
-#include "search.h"
+#include "thread.h"
+#include "evaluate.h"
+#include "perfstat.h"
 
 #include <iostream>
 #include <sstream>
@@ -76,13 +78,15 @@ void Position::init()
 }
 
 // sfen文字列で盤面を設定する
-void Position::set(std::string sfen, StateInfo* si)
+void Position::set(std::string sfen, StateInfo* si, Thread* th)
 {
   std::memset(this, 0, sizeof(Position));
 
   std::memset(si, 0, sizeof(StateInfo));
   st = si;
 
+  thisThread = th;
+
   // --- 盤面
   File f = FILE_5;
   Rank r = RANK_1;
@@ -479,6 +483,23 @@ bool Position::gives_check(Move m) const
     && !aligned(from, to, king_square(~sideToMove)));
 }
 
+// 16bitの指し手を32bitの指し手に変換する。
+Move Position::to_move(Move m16) const
+{
+  // MOVE_NONE , MOVE_NULLなど
+  if (!is_ok(m16))
+    return m16;
+
+  if (is_drop(m16))
+    return Move(m16 + (make_piece(sideToMove, move_dropped_piece(m16)) << 16));
+
+  const Piece pc = piece_on(move_from(m16));
+  if (pc == NO_PIECE)
+    return MOVE_NONE;
+
+  return Move(m16 + ((is_promote(m16) ? pc + PIECE_PROMOTE : pc) << 16));
+}
+
 // 現局面で指し手がないかをテストする。指し手生成ルーチンを用いるので速くない。探索中には使わないこと。
 bool Position::is_mated() const
 {
@@ -719,7 +740,7 @@ void Position::do_move_impl(Move m, StateInfo& new_st, bool givesCheck)
   ASSERT_LV3(&new_st != st);
 
   // 探索ノード数 ≒do_move()の呼び出し回数のインクリメント。
-  Search::Nodes += 1;
+  thisThread->nodes.fetch_add(1, std::memory_order_relaxed);
 
   // ----------------------
   //  StateInfoの更新
@@ -964,6 +985,8 @@ void Position::undo_move_impl(Move m)
 // do_move()を先後分けたdo_move_impl<>()を呼び出す。
 void Position::do_move(Move m, StateInfo& newSt, bool givesCheck)
 {
+  PERF_REGION(DO_MOVE);
+
   if (sideToMove == BLACK)
     do_move_impl<BLACK>(m, newSt, givesCheck);
   else
@@ -990,9 +1013,17 @@ void Position::do_null_move(StateInfo& newSt)
   st = &newSt;
 
   st->pliesFromNull = 0;
+  st->lastMove = MOVE_NULL;
+  st->capturedPiece = NO_PIECE;
+
+  // 手番が変わるので、hash keyの手番のbitも反転させる。
+  st->board_key_ ^= Zobrist::side;
 
   sideToMove = ~sideToMove;
 
+  // StateInfo::handは手番側の持ち駒
+  st->hand = hand[sideToMove];
+
   set_check_info<true>(st);
 }
 
@@ -1072,6 +1103,239 @@ RepetitionState Position::is_repetition(int repPly /* = 16 */) const
   return REPETITION_NONE;
 }
 
+// ----------------------------------
+//      SEE(静的交換評価)
+// ----------------------------------
+
+// 指し手mの移動先の升で駒の取り合いをしたときに、駒得の量がthreshold以上になるか。
+// 両者とも、その升に利いている駒のうち最も価値の低い駒から順に取り合い、
+// 取り合いを続けると損になる側はそこで取り合いをやめるものとする。
+// 取り合いで駒が取り除かれることで、背後の大駒の利きが通る(x-ray)のも考慮する。
+bool Position::see_ge(Move m, Value threshold) const
+{
+  // 取り合いに参加する駒の種類。価値の低い順。(GOLDSは金・と・成銀)
+  static const Piece SeePieces[] = { PAWN, SILVER, GOLDS, BISHOP, HORSE, ROOK, DRAGON };
+
+  const Square to = move_to(m);
+
+  // 取る駒の価値 - threshold。これが負なら、取り返されなくてもthresholdに届かない。
+  int swap = Eval::PieceValue[type_of(piece_on(to))] - threshold;
+  if (swap < 0)
+    return false;
+
+  // 移動させた駒を取り返されても、まだthreshold以上であるか。
+  const Piece moved = is_drop(m) ? move_dropped_piece(m) : type_of(piece_on(move_from(m)));
+  swap = Eval::PieceValue[moved] - swap;
+  if (swap <= 0)
+    return true;
+
+  // 移動元の駒は取り除いておく。(toの駒は取られたものとして、以降は利きの判定にだけ使う)
+  Bitboard occupied = is_drop(m) ? pieces() : pieces() ^ move_from(m);
+  Color stm = sideToMove;
+  Bitboard attackers = attackers_to(to, occupied);
+  Bitboard stmAttackers, bb;
+
+  // 現在の手番側から見て、取り合いを終えたときにthreshold以上であるなら1
+  int res = 1;
+
+  while (true)
+  {
+    stm = ~stm;
+    attackers &= occupied;
+
+    // 取り返す駒がなければ終了
+    if (!(stmAttackers = attackers & pieces(stm)))
+      break;
+
+    // pinされている駒は、pinしている駒がまだ盤上にあるなら取り合いに参加できない
+    if (st->pinners[stm] & occupied)
+      stmAttackers &= ~blockers_for_king(stm);
+
+    if (!stmAttackers)
+      break;
+
+    res ^= 1;
+
+    // 最も価値の低い駒で取り返す
+    Piece pt = NO_PIECE;
+    for (Piece p : SeePieces)
+      if ((bb = stmAttackers & pieces(p)))
+      {
+        pt = p;
+        break;
+      }
+
+    // 玉でしか取り返せない場合は、相手にまだ取り返す駒があるなら取り返せない
+    if (pt == NO_PIECE)
+      return (attackers & ~pieces(stm)) ? res ^ 1 : res;
+
+    // 取り返した駒を取られても、まだthreshold以上であるか
+    if ((swap = Eval::PieceValue[pt == GOLDS ? GOLD : pt] - swap) < res)
+      break;
+
+    // 取り返した駒を取り除いて、その背後にある大駒の利きを追加する
+    occupied ^= bb.pop_c();
+    attackers |= (bishopEffect(to, occupied) & pieces(BISHOP_HORSE))
+               | (rookEffect(to, occupied) & pieces(ROOK_DRAGON));
+  }
+
+  return bool(res);
+}
+
+// ----------------------------------
+//      1手詰め、3手詰め判定
+// ----------------------------------
+
+Move Position::mate1ply() const
+{
+  // 王手がかかっているときは、王手を回避しながら王手する指し手を調べないといけないので調べない。
+  if (in_check())
+    return MOVE_NONE;
+
+  const Color us = sideToMove, them = ~us;
+  const Square ksq = king_square(them);
+
+  // 駒pc(移動後の駒)をfromからtoに移動させた(fromがSQ_NBなら駒打ち)あとに相手玉が詰んでいるか。
+  // 前提条件 : 合法手で、王手になる指し手であること。
+  auto is_mate = [&](Piece pc, Square from, Square to) {
+
+    const Bitboard occ = (from == SQ_NB ? pieces() : pieces() ^ from) | to;
+    const Bitboard ours = from == SQ_NB ? pieces(us) : pieces(us) ^ from;
+
+    // 王手している駒を玉以外の駒で取れるなら詰みではない。(相手の駒がpinされているかは考えない)
+    if (attackers_to(them, to, occ) & ~Bitboard(ksq))
+      return false;
+
+    // 玉の逃げ道があるなら詰みではない。
+    // 玉が移動すると玉の背後にも大駒の利きが通るので、玉を取り除いた盤面で利きを調べる。
+    // toの駒は玉で取れる升として逃げ道に含めるので、toに利いている自駒がなければ詰みではない。
+    const Bitboard occNoKing = occ ^ ksq;
+    const Bitboard toEffect = effects_from(pc, to, occNoKing);
+    Bitboard escapes = kingEffect(ksq) & ~(pieces(them) & ~Bitboard(to)) & ~toEffect;
+    while (escapes)
+      if (!(attackers_to(us, escapes.pop(), occNoKing) & ours))
+        return false;
+
+    // 遠方からの王手は、合駒ができるなら詰みではない。
+    // 手駒があれば打てるものとし、玉以外の駒が間の升に移動できるなら合駒できるものとする。
+    Bitboard between = between_bb(to, ksq);
+    if (between)
+    {
+      if (hand_of(them) != HAND_ZERO)
+        return false;
+
+      while (between)
+        if (attackers_to(them, between.pop(), occ) & ~Bitboard(ksq))
+          return false;
+    }
+
+    return true;
+  };
+
+  // 駒打ち。打ち歩詰めは反則なので歩は除く。
+  // 駒を打つ指し手は、王手がかかっていなければ常に合法。
+  const Hand h = hand_of(us);
+  for (Piece pt : { SILVER, GOLD, BISHOP, ROOK })
+  {
+    if (!hand_exists(h, pt))
+      continue;
+
+    const Piece pc = make_piece(us, pt);
+    Bitboard target = check_squares(pt) & empties();
+    while (target)
+    {
+      const Square to = target.pop();
+      if (is_mate(pc, SQ_NB, to))
+        return Move(make_move_drop(pt, to) + (pc << 16));
+    }
+  }
+
+  // 駒の移動。玉で王手することはできないので玉は除く。
+  Bitboard froms = pieces(us) ^ king_square(us);
+  while (froms)
+  {
+    const Square from = froms.pop();
+    const Piece pc = piece_on(from);
+    const Piece pt = type_of(pc);
+
+    Bitboard target = effects_from(pc, from, pieces()) & ~pieces(us);
+
+    // pinされている駒は、自玉との直線上にしか移動できない。
+    if (blockers_for_king(us) & from)
+      target &= line_bb(king_square(us), from);
+
+    // 成れる駒(歩、銀、角、飛)は、移動元か移動先が敵陣なら成ることができる。
+    // 歩は敵陣(最終段)に不成で移動することはできない。
+    const bool canPromote = pt == PAWN || pt == SILVER || pt == BISHOP || pt == ROOK;
+
+    Bitboard nonPromote = target & check_squares(pt);
+    if (pt == PAWN)
+      nonPromote &= ~enemy_field(us);
+
+    while (nonPromote)
+    {
+      const Square to = nonPromote.pop();
+      if (is_mate(pc, from, to))
+        return Move(make_move(from, to) + (pc << 16));
+    }
+
+    if (!canPromote)
+      continue;
+
+    const Piece pcPromoted = Piece(pc + PIECE_PROMOTE);
+    Bitboard promote = target & check_squares(Piece(pt + PIECE_PROMOTE));
+    if (!(enemy_field(us) & from))
+      promote &= enemy_field(us);
+
+    while (promote)
+    {
+      const Square to = promote.pop();
+      if (is_mate(pcPromoted, from, to))
+        return Move(make_move_promote(from, to) + (pcPromoted << 16));
+    }
+  }
+
+  return MOVE_NONE;
+}
+
+Move Position::mate3ply()
+{
+  if (in_check())
+    return MOVE_NONE;
+
+  StateInfo si, si2;
+
+  for (Move m : MoveList<CHECKS>(*this))
+  {
+    if (!legal(m))
+      continue;
+
+    do_move(m, si, true);
+
+    // 相手のすべての応手に対して1手詰めがあれば詰み。(応手がなければ、この指し手で詰んでいる)
+    bool mated = true;
+    for (Move e : MoveList<EVASIONS_ALL>(*this))
+    {
+      if (!legal(e))
+        continue;
+
+      do_move(e, si2);
+      mated = mate1ply() != MOVE_NONE;
+      undo_move(e);
+
+      if (!mated)
+        break;
+    }
+
+    undo_move(m);
+
+    if (mated)
+      return m;
+  }
+
+  return MOVE_NONE;
+}
+
 
 bool Position::pos_is_ok() const
 {
@@ -6,6 +6,8 @@
 #include <deque>
 #include <memory> // std::unique_ptr
 
+class Thread;
+
 // --------------------
 //     局面の定数
 // --------------------
@@ -101,14 +103,15 @@ public:
 	// 局面を遡るために、rootまでの局面の情報が必要であるから、それを引数のsiで渡してやる。
 	// 遡る必要がない場合は、StateInfo si;に対して&siなどとして渡しておけば良い。
 	// 内部的にmemset(si,0,sizeof(StateInfo))として、この渡されたインスタンスをクリアしている。
-  void set(std::string sfen, StateInfo* si);
+	// th : この局面で探索を行うスレッド。do_move()で探索ノード数を加算するのに使う。
+  void set(std::string sfen, StateInfo* si, Thread* th);
 
   // 局面のsfen文字列を取得する
   const std::string sfen() const;
 
   // 平手の初期局面を設定する。
   // siについては、上記のset()にある説明を読むこと。
-  void set_hirate(StateInfo* si) { set(SFEN_HIRATE, si); }
+  void set_hirate(StateInfo* si, Thread* th) { set(SFEN_HIRATE, si, th); }
 
 	// --- properties
 
@@ -139,6 +142,11 @@ public:
 		return Piece(m >> 16);
 	}
 
+	// 16bitの指し手(置換表に格納されている指し手など)を、上位16bitに移動後の駒を格納した32bitの指し手に変換する。
+	// 移動元に駒がなければMOVE_NONEを返す。
+	// ※　変換後の指し手が擬似合法手であるかは調べていないので、呼び出し側でpseudo_legal()を用いて確認すること。
+	Move to_move(Move m16) const;
+
 	// 普通の千日手、連続王手の千日手等を判定する。
 	// そこまでの局面と同一局面であるかを、局面を遡って調べる。
 	// rep_ply : 遡る手数。デフォルトでは16手。あまり大きくすると速度低下を招く。
@@ -269,6 +277,18 @@ public:
 			|| ((pawnEffect(us, to) == Bitboard(king_square(~us)) && !legal_drop(to)))); // 打ち歩詰め
 	}
 
+	// --- 指し手の種類
+
+	// 指し手mが駒を捕獲する指し手であるか。
+	bool capture(Move m) const { return !is_drop(m) && piece_on(move_to(m)) != NO_PIECE; }
+
+	// 指し手mが駒を捕獲する指し手か、歩の成りであるか。
+	// CAPTURES_PRO_PLUSで生成される指し手ならtrue、NON_CAPTURES_PRO_MINUSで生成される指し手ならfalseになる。
+	bool capture_or_pawn_promotion(Move m) const
+	{
+		return capture(m) || (is_promote(m) && type_of(piece_on(move_from(m))) == PAWN);
+	}
+
 	// --- StateInfo
 
 	// 現在の局面に対応するStateInfoを返す。
@@ -283,6 +303,26 @@ public:
 	// 現局面で指し手がないかをテストする。指し手生成ルーチンを用いるので速くない。探索中には使わないこと。
 	bool is_mated() const;
 
+	// --- SEE
+
+	// 指し手mで駒を取り合ったときに、駒得の量がthreshold以上になるかを判定する。(静的交換評価)
+	// 駒打ちの指し手も渡して良い。
+	bool see_ge(Move m, Value threshold = VALUE_ZERO) const;
+
+	// --- 詰み
+
+	// 現局面で1手詰めがあれば、その指し手を返す。なければMOVE_NONE。
+	// 指し手生成を行わず、王手になる升(check_squares)への駒打ちと駒の移動について、
+	// 玉の逃げ道、王手している駒の捕獲、合駒の可否を利きだけで調べる。
+	// 判定は保守的で、詰みを見逃すことはあるが、詰みでないものを詰みと判定することはない。
+	// 王手がかかっている局面では調べない。(MOVE_NONEを返す)
+	Move mate1ply() const;
+
+	// 現局面で3手詰めがあれば、その初手を返す。なければMOVE_NONE。
+	// 王手をすべて試して、相手のすべての応手に対してmate1ply()で詰みが見つかるかを調べる。
+	// 指し手生成を行うのでmate1ply()よりずっと遅い。
+	Move mate3ply();
+
 	// --- Accessing hash keys
 
 	// StateInfo::key()への簡易アクセス。
@@ -299,6 +339,9 @@ public:
 	// 局面を出力する。(USI形式ではない) デバッグ用。
 	friend std::ostream& operator<<(std::ostream& os, const Position& pos);
 
+	// この局面で探索を行っているスレッドを返す。
+	Thread* this_thread() const { return thisThread; }
+
 private:
 	// StateInfoの初期化(初期化するときに内部的に用いる)
 	void set_state(StateInfo* si) const;
@@ -356,6 +399,9 @@ private:
 	int gamePly;
 
 	StateInfo* st;
+
+	// この局面で探索を行っているスレッド
+	Thread* thisThread;
 };
 
 inline void Position::xor_piece(Square sq, Piece pc)
@@ -1,287 +1,1296 @@
 ﻿#include <algorithm>
-#include <thread>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
 
 #include "search.h"
 #include "usi.h"
 #include "evaluate.h"
 #include "misc.h"
+#include "tt.h"
+#include "thread.h"
+#include "movepick.h"
+#include "mate.h"
+#include "timeman.h"
+#include "perfstat.h"
 
-struct MovePicker
+namespace Search
+{
+    // 持ち時間設定など。
+    LimitsType Limits;
+
+    // 前回のgoコマンドでの探索の統計情報
+    Stats LastStats;
+}
+
+namespace
 {
-    // 静止探索で使用
-    MovePicker(const Position& pos_, Square recapSq) : pos(pos_)
+    // 探索するnodeの種類。search()、qsearch()はこれをtemplate引数にとり、
+    // PV nodeだけで行う処理(PVの更新など)やrootだけで行う処理は、それ以外のnodeではコンパイル時に取り除かれる。
+    // Root : 探索開始局面, PV : 通常の窓で探索するnode, NonPV : null windowで探索するnode
+    enum NodeType { NonPV, PV, Root };
+
+    // 浅い深さでの枝刈りのマージン。探索開始時にUSIのoptionから読み込む。
+    int RazoringMargin, FutilityMargin, FutilityMarginQuiet;
+
+    // 3手詰めを調べる残り深さの下限。3手詰めの判定は指し手生成を伴って重いので、末端付近では行わない。
+    constexpr int Mate3plyDepth = 6;
+
+    // reverse futility pruningのマージン
+    Value futility_margin(int depth, bool improving)
     {
-        if (pos.in_check())
-            endMoves = generateMoves<EVASIONS>(pos, currentMoves);
-        else
-            endMoves = generateMoves<RECAPTURES>(pos, currentMoves, recapSq);
+        return Value(FutilityMargin * (depth - improving));
     }
 
-    Move nextMove() 
+    // 残り探索深さdepthで、これ以上の数の静かな指し手を探索したら、残りの静かな指し手は枝刈りする。(move count pruning)
+    int futility_move_count(bool improving, int depth)
     {
-        if (currentMoves == endMoves)
-            return MOVE_NONE;
-        return *currentMoves++;
+        return (3 + depth * depth) / (2 - improving);
     }
 
-private:
-    const Position& pos;
-    ExtMove moves[MAX_MOVES], * currentMoves = moves, * endMoves = moves;
-};
+    // Late Move Reductionで削減する深さのテーブル。[depth or moveCount]
+    // moveCountは最大でMAX_MOVES、depthはMAX_PLY未満になる。
+    static_assert(MAX_PLY < MAX_MOVES, "Reductions[] is too small for depth");
+    int Reductions[MAX_MOVES + 1];
 
-namespace Search
+    // 残り探索深さdepthで、moveCount番目の指し手を探索するときに削減する深さ
+    // improving : 2手前の局面より評価値が改善しているか
+    int reduction(bool improving, int depth, int moveCount)
+    {
+        int r = Reductions[depth] * Reductions[moveCount];
+        return (r + 520) / 1024 + (!improving && r > 999);
+    }
+}
+
+// 起動時に呼び出される。時間のかからない探索関係の初期化処理はここに書くこと。
+void Search::init()
 {
-    // 探索開始局面で思考対象とする指し手の集合。
-    RootMoves rootMoves;
+    for (int i = 1; i <= MAX_MOVES; ++i)
+        Reductions[i] = int(22.9 * std::log(i));
+}
 
-    // 持ち時間設定など。
-    LimitsType Limits;
+// isreadyコマンドの応答中に呼び出される。時間のかかる処理はここに書くこと。
+void Search::clear()
+{
+    TT.clear();
+    MateTT.clear();
+    Threads.clear();
+}
 
-    // 今回のgoコマンドでの探索ノード数。
-    uint64_t Nodes;
+Search::Stats& Search::Stats::operator+=(const Stats& s)
+{
+    mainNodes += s.mainNodes;
+    qNodes += s.qNodes;
+    ttProbes += s.ttProbes;
+    ttHits += s.ttHits;
+    ttCutoffs += s.ttCutoffs;
+    betaCutoffs += s.betaCutoffs;
+    firstMoveCutoffs += s.firstMoveCutoffs;
+    nullMoveTries += s.nullMoveTries;
+    nullMoveCutoffs += s.nullMoveCutoffs;
+    lmrSearches += s.lmrSearches;
+    lmrResearches += s.lmrResearches;
+
+    // depthNodesはmain threadだけが記録している
+    for (int d = 0; d < MAX_PLY; ++d)
+        depthNodes[d] += s.depthNodes[d];
 
-    // 探索中にこれがtrueになったら探索を即座に終了すること。
-    bool Stop;
+    return *this;
 }
 
-// 起動時に呼び出される。時間のかからない探索関係の初期化処理はここに書くこと。
-void Search::init() {}
+void Search::Stats::print() const
+{
+#if !defined(USE_SEARCH_STATS)
+    std::cout << "info string stats are not collected. define USE_SEARCH_STATS in config.h." << std::endl;
+#else
+    // a / b を百分率で
+    auto percent = [](u64 a, u64 b) { return b ? 100.0 * a / b : 0.0; };
 
-// isreadyコマンドの応答中に呼び出される。時間のかかる処理はここに書くこと。
-void Search::clear() {}
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(1);
+
+    const u64 nodes = mainNodes + qNodes;
+    ss << "info string stats nodes " << nodes
+       << " search " << mainNodes << " qsearch " << qNodes << " (" << percent(qNodes, nodes) << "%)" << std::endl;
+
+    ss << "info string stats tt probes " << ttProbes
+       << " hits " << ttHits << " (" << percent(ttHits, ttProbes) << "%)"
+       << " cutoffs " << ttCutoffs << " (" << percent(ttCutoffs, ttProbes) << "%)" << std::endl;
+
+    ss << "info string stats beta cutoffs " << betaCutoffs
+       << " first move " << firstMoveCutoffs << " (" << percent(firstMoveCutoffs, betaCutoffs) << "%)" << std::endl;
+
+    ss << "info string stats null move tries " << nullMoveTries
+       << " cutoffs " << nullMoveCutoffs << " (" << percent(nullMoveCutoffs, nullMoveTries) << "%)" << std::endl;
+
+    ss << "info string stats lmr searches " << lmrSearches
+       << " re-searches " << lmrResearches << " (" << percent(lmrResearches, lmrSearches) << "%)" << std::endl;
+
+    // 反復ごとのnode数と、前の反復に対する比(分岐係数)
+    ss << std::setprecision(2);
+    u64 prevIterNodes = 0;
+    for (int d = 1; d < MAX_PLY && depthNodes[d]; ++d)
+    {
+        const u64 iterNodes = depthNodes[d] - depthNodes[d - 1];
+        ss << "info string stats depth " << d << " nodes " << iterNodes;
+        if (prevIterNodes)
+            ss << " ebf " << double(iterNodes) / prevIterNodes;
+        ss << std::endl;
+        prevIterNodes = iterNodes;
+    }
 
-Value search(Position& pos, Value alpha, Value beta, int depth, int ply_from_root);
-Value qsearch(Position& pos, Value alpha, Value beta, int depth, int ply_from_root);
+    std::cout << ss.str() << std::flush;
+#endif
+}
 
-// 探索を開始する
-void Search::start_thinking(const Position& rootPos, StateListPtr& states, LimitsType limits)
+namespace
 {
-    Limits = limits;
-    rootMoves.clear();
-    Nodes = 0;
-    Stop = false;
-
-    for (Move move : MoveList<LEGAL_ALL>(rootPos))
-        rootMoves.emplace_back(move);
-
-    ASSERT_LV3(states.get());
-    
-    Position* pos_ptr = const_cast<Position*>(&rootPos);
-    search(*pos_ptr);
+    // PVを更新する。moveのあとに子局面のPV(childPv)を連結したものをpvに格納する。
+    void update_pv(Move* pv, Move move, const Move* childPv)
+    {
+        for (*pv++ = move; *childPv != MOVE_NONE; )
+            *pv++ = *childPv++;
+        *pv = MOVE_NONE;
+    }
+
+    // 詰みのスコアはrootからの手数で表現されているので、置換表に格納するときは
+    // その局面からの手数に直す。(同じ局面に別の手数で到達しても使えるように)
+    Value value_to_tt(Value v, int ply)
+    {
+        ASSERT_LV3(v != VALUE_NONE);
+
+        return v >= VALUE_MATE_IN_MAX_PLY ? v + ply
+             : v <= VALUE_MATED_IN_MAX_PLY ? v - ply : v;
+    }
+
+    // value_to_tt()の逆変換。置換表から取り出した詰みのスコアをrootからの手数に直す。
+    Value value_from_tt(Value v, int ply)
+    {
+        return v == VALUE_NONE ? VALUE_NONE
+             : v >= VALUE_MATE_IN_MAX_PLY ? v - ply
+             : v <= VALUE_MATED_IN_MAX_PLY ? v + ply : v;
+    }
+
+    // 残り探索深さdepthでのhistoryの加点
+    int stat_bonus(int depth)
+    {
+        return depth > 17 ? 0 : 29 * depth * depth + 138 * depth - 134;
+    }
+
+    // 1手前、2手前の指し手と、この局面での指し手(移動後の駒pc, 移動先to)の組み合わせのhistoryを更新する。
+    void update_continuation_histories(Search::Stack* ss, Piece pc, Square to, int bonus)
+    {
+        for (int i : {1, 2})
+            if (is_ok((ss - i)->currentMove))
+                (*(ss - i)->continuationHistory)[pc][to] << bonus;
+    }
+
+    // 最善手となった静かな指し手で、killer、counter move、historyを更新する。
+    // 最善手より前に探索した静かな指し手(quiets)のhistoryは減点する。
+    void update_quiet_stats(const Position& pos, Search::Stack* ss, Move move, Move* quiets, int quietCount, int bonus)
+    {
+        if (ss->killers[0] != move)
+        {
+            ss->killers[1] = ss->killers[0];
+            ss->killers[0] = move;
+        }
+
+        const Color us = pos.side_to_move();
+        Thread* thisThread = pos.this_thread();
+        thisThread->mainHistory[us][from_to(move)] << bonus;
+        update_continuation_histories(ss, pos.moved_piece_after(move), move_to(move), bonus);
+
+        Move prevMove = (ss - 1)->currentMove;
+        if (is_ok(prevMove))
+        {
+            Square prevSq = move_to(prevMove);
+            thisThread->counterMoves[pos.piece_on(prevSq)][prevSq] = move;
+        }
+
+        for (int i = 0; i < quietCount; ++i)
+        {
+            thisThread->mainHistory[us][from_to(quiets[i])] << -bonus;
+            update_continuation_histories(ss, pos.moved_piece_after(quiets[i]), move_to(quiets[i]), -bonus);
+        }
+    }
+
+    // 最善手が捕獲する指し手であればそのcapture historyを加点し、
+    // 最善手より前に探索した捕獲する指し手(captures)のcapture historyは減点する。
+    void update_capture_stats(const Position& pos, Move move, Move* captures, int captureCount, int bonus)
+    {
+        CapturePieceToHistory& captureHistory = pos.this_thread()->captureHistory;
+
+        if (pos.capture_or_pawn_promotion(move))
+            captureHistory[pos.moved_piece_after(move)][move_to(move)][type_of(pos.piece_on(move_to(move)))] << bonus;
+
+        for (int i = 0; i < captureCount; ++i)
+            captureHistory[pos.moved_piece_after(captures[i])][move_to(captures[i])][type_of(pos.piece_on(move_to(captures[i])))] << -bonus;
+    }
 }
 
-// 探索本体
-void Search::search(Position& pos)
+template <NodeType nodeType>
+Value search(Position& pos, Search::Stack* ss, Value alpha, Value beta, int depth);
+
+// rootの指し手の探索。rootの指し手(Thread::rootMoves)だけを調べるので、search()とは別に実装する。
+template <>
+Value search<Root>(Position& pos, Search::Stack* ss, Value alpha, Value beta, int depth);
+
+template <NodeType nodeType>
+Value qsearch(Position& pos, Search::Stack* ss, Value alpha, Value beta, int depth);
+
+// 探索開始時に呼び出される。
+// 時間制御を行い、他のスレッドとともに探索したあと、bestmoveを出力する。
+void MainThread::search()
 {
+    // 持ち時間、加算時間、秒読みと手数から今回の思考時間を決める
+    // 思考時間の上限に達したかは、探索中にcheck_time()で調べる。
+    Timeman.init(Search::Limits, rootPos.side_to_move(), rootPos.game_ply());
+
+    // go mateであれば、df-pnで詰みを探して、結果をcheckmateで返す
+    if (Search::Limits.mate)
+    {
+        std::vector<Move> pv;
+        Mate::Result result = Mate::search(rootPos, pv);
+
+        Threads.stop = true;
+
+        std::cout << "checkmate";
+        if (result == Mate::MATE)
+            for (Move m : pv)
+                std::cout << ' ' << m;
+        else
+            std::cout << (result == Mate::NO_MATE ? " nomate" : " timeout");
+        std::cout << std::endl;
+        return;
+    }
+
+    // 置換表の世代を進める
+    TT.new_search();
+
+    // 枝刈りのマージンを読み込む
+    RazoringMargin = Options["RazoringMargin"];
+    FutilityMargin = Options["FutilityMargin"];
+    FutilityMarginQuiet = Options["FutilityMarginQuiet"];
+
     // 探索で返す指し手
     Move bestMove = MOVE_RESIGN;
 
+    // 相手の予想手。bestmoveのあとにponderとして出力する。
+    Move ponderMove = MOVE_NONE;
+
     if (rootMoves.size() == 0)
     {
         // 合法手が存在しない
-        Stop = true;
+        Threads.stop = true;
         goto END;
     }
 
-    /* ここから探索部を記述する */
     {
-        /* 時間制御 */
-        Color us = pos.side_to_move();
-        std::thread* timerThread = nullptr;
+        // main thread以外の探索を開始する
+        Threads.start_searching();
+
+        // main threadも探索に参加する
+        Thread::search();
+
+        // 思考時間無制限かponder中であれば、反復深化を終えてもstop(ponder中ならponderhit)が来るまではbestmoveを返さない。
+        // 探索ノードがないので、check_time()の代わりに条件変数で待機する。ponder中は時間の制限なく待機する。
+        if (Search::Limits.infinite || ponder)
+            Threads.wait_for_stop(ponder ? INT64_MAX : Timeman.maximum());
+
+        // 探索を終了させ、すべてのスレッドの探索が終わるのを待つ
+        Threads.stop = true;
+        Threads.wait_for_search_finished();
+
+        // すべてのスレッドの探索の統計情報を合計する
+        SEARCH_STATS(Search::LastStats = Search::Stats();
+                     for (Thread* th : Threads)
+                         Search::LastStats += th->stats);
+
+        // 最も良い結果を得たスレッドを選ぶ。
+        // 完了した反復深化の深さがmain thread以上で、評価値が高いスレッドがあればそれを採用する。
+        // 詰みを見つけたスレッドであれば、深さによらず採用する。
+        Thread* bestThread = this;
+        for (Thread* th : Threads)
+        {
+            int depthDiff = th->completedDepth - bestThread->completedDepth;
+            Value scoreDiff = th->rootMoves[0].score - bestThread->rootMoves[0].score;
+
+            if (scoreDiff > 0 && (depthDiff >= 0 || th->rootMoves[0].score >= VALUE_MATE_IN_MAX_PLY))
+                bestThread = th;
+        }
+
+        // main thread以外の結果を採用するなら、その読み筋を出力しなおす
+        if (bestThread != this)
+            std::cout << USI::pv(bestThread->rootPos, bestThread->completedDepth) << std::endl;
+
+        // プレイヤが返す指し手
+        bestMove = bestThread->rootMoves[0].pv[0];
+
+        // PVの2手目を相手の予想手とする。PVが1手しかなければ置換表から取り出す。
+        Search::RootMove& rm = bestThread->rootMoves[0];
+        if (rm.pv.size() > 1 || rm.extract_ponder_from_tt(rootPos))
+            ponderMove = rm.pv[1];
+
+        // 次回のgoコマンドで、評価値が下がったかを判定するために覚えておく
+        bestPreviousScore = bestThread->rootMoves[0].score;
+    }
+
+END:;
+    std::cout << "bestmove " << bestMove;
+    if (ponderMove != MOVE_NONE)
+        std::cout << " ponder " << ponderMove;
+    std::cout << std::endl;
+}
+
+// 最善手で進めた局面の置換表の指し手を、相手の予想手としてpv[1]に追加する。
+// PVが1手しかない(探索を打ち切ったなど)ときに、ponderの指し手を得るために用いる。
+bool Search::RootMove::extract_ponder_from_tt(Position& pos)
+{
+    ASSERT_LV3(pv.size() == 1);
+
+    StateInfo si;
+    pos.do_move(pv[0], si);
+
+    bool ttHit;
+    TTData ttData;
+    TT.probe(pos.key(), ttHit, ttData);
+    if (ttHit)
+    {
+        Move m = pos.to_move(ttData.move);
+        if (m != MOVE_NONE && pos.pseudo_legal(m) && pos.legal(m))
+            pv.push_back(m);
+    }
 
-        // 今回は秒読み以外の設定は考慮しない
-        s64 endTime = Limits.byoyomi[us] - 150;
+    pos.undo_move(pv[0]);
+    return pv.size() > 1;
+}
 
-        timerThread = new std::thread([&] {
-            while (Time.elapsed() < endTime && !Stop)
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            Stop = true;
-        });
+// main threadの探索中に呼び出され、思考時間の上限か、指定された探索ノード数に達していれば探索を終了させる。
+// 時刻の取得は安くないので、CheckTimeInterval回の呼び出しに1回だけ時刻を調べる。
+// main threadのノード数でおよそ1msごとに調べることになり、これが思考時間の精度となる。
+void MainThread::check_time()
+{
+    if (--callsCnt > 0)
+        return;
 
-        // 探索深さ．初期値は1
-        int rootDepth = 1;
+    // 探索ノード数が指定されているときは、ちょうどそのノード数で止まるように毎回調べる。
+    callsCnt = Search::Limits.nodes ? 1 : CheckTimeInterval;
 
-        // 反復深化
-        while (!Stop)
+    // ponder中は、ponderhitが来るまで探索を終了しない
+    if (ponder)
+        return;
+
+    // ponderhitのあとの最初の呼び出し。自分の持ち時間が減り始めたのはponderhitからなので、思考時間の上限を延ばす。
+    if (ponderhitPending)
+    {
+        ponderhitPending = false;
+        Timeman.on_ponderhit();
+    }
+
+    if (stopOnPonderhit
+        || (Search::Limits.nodes && Threads.nodes_searched() >= u64(Search::Limits.nodes))
+        || Timeman.elapsed() >= Timeman.maximum())
+        Threads.stop = true;
+}
+
+// 探索本体。反復深化を行う。
+// すべてのスレッドがこの関数を呼び出し、置換表を共有しながら同じ局面を探索する。(Lazy SMP)
+void Thread::search()
+{
+    // helper threadが反復深化の深さを飛ばすためのテーブル。
+    // helper threadごとに飛ばす深さをずらして、スレッドの探索深さが揃いすぎないようにする。
+    static const int SkipSize[]  = { 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4 };
+    static const int SkipPhase[] = { 0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7 };
+
+    // rootの局面の詰み探索を担当するスレッドであれば、通常の探索は行わない
+    if (mateSearcher)
+    {
+        search_mate();
+        return;
+    }
+
+    Position& pos = rootPos;
+
+    // 探索用のstack。ss[0]がrootの局面。
+    Search::Stack* ss = stack + 2;
+    std::memset(stack, 0, sizeof(stack));
+    for (int i = 0; i < MAX_PLY + 4; ++i)
+        stack[i].st = &states[i];
+    moveBufferEnd = moveBuffer;
+    for (int i = 0; i <= MAX_PLY + 1; ++i)
+        (ss + i)->ply = i;
+
+    // rootより前の指し手はないので、continuation historyは番兵を指しておく。
+    for (int i = 2; i > 0; --i)
+        (ss - i)->continuationHistory = &continuationHistory[NO_PIECE][0];
+
+    // 時間制御はmain threadだけが行う
+    MainThread* mainThread = this == Threads.main() ? Threads.main() : nullptr;
+
+    // 直近の反復での評価値。評価値が下がってきているなら思考時間を増やす。
+    // 前回のgoコマンドの評価値がなければ0で初期化しておく。
+    Value iterValue[4];
+    int iterIdx = 0;
+    if (mainThread)
+        std::fill(std::begin(iterValue), std::end(iterValue),
+            mainThread->bestPreviousScore == VALUE_INFINITE ? VALUE_ZERO : mainThread->bestPreviousScore);
+
+    // 最善手が安定していたために思考時間を減らす割合
+    double timeReduction = 1.0;
+
+    // 探索するPVの数。合法手の数より多くはできない。
+    const size_t multiPV = std::min(size_t(int(Options["MultiPV"])), rootMoves.size());
+
+    // 反復深化
+    // 探索深さが指定されていれば、main threadがその深さを探索し終えたところで終了する。
+    while (++rootDepth < MAX_PLY && !Threads.stop
+        && !(Search::Limits.depth && mainThread && rootDepth > Search::Limits.depth))
+    {
+        // main thread以外は、一部の深さを飛ばす
+        if (thread_id() > 0)
         {
+            int i = (thread_id() - 1) % 20;
+            if (((rootDepth + SkipPhase[i]) / SkipSize[i]) % 2)
+                continue;
+        }
+
+        for (Search::RootMove& rm : rootMoves)
+            rm.previousScore = rm.score;
+
+        // MultiPVであれば、上位multiPV個の指し手をそれぞれ独立した窓で探索する。
+        // pvIdx番目の探索では、それより前の(探索済みの)指し手を除いたrootの指し手から最善手を求める。
+        for (pvIdx = 0; pvIdx < multiPV && !Threads.stop; ++pvIdx)
+        {
+            selDepth = 0;
+
             // α値
             Value alpha = -VALUE_INFINITE;
 
             // β値
             Value beta = VALUE_INFINITE;
 
-            // do_move()に必要
-            StateInfo si;
+            // aspiration windowの幅
+            Value delta = -VALUE_INFINITE;
+
+            // -----------------------
+            //  aspiration window
+            // -----------------------
 
-            for (int i = 0; i < rootMoves.size(); ++i)
+            // 前回のiterationの評価値を中心とした狭い窓で探索する。
+            // 前回の評価値がない(最初の指し手を探索し終える前に停止した)場合は、通常の窓で探索する。
+            const Value previousScore = rootMoves[pvIdx].previousScore;
+            if (rootDepth >= 5 && previousScore != -VALUE_INFINITE)
             {
-                Move move = rootMoves[i].pv[0];
+                delta = Value(20);
+                alpha = std::max(previousScore - delta, -VALUE_INFINITE);
+                beta  = std::min(previousScore + delta,  VALUE_INFINITE);
+            }
 
-                // 局面を1手進める
-                pos.do_move(move, si);
+            while (true)
+            {
+                Value bestValue = ::search<Root>(pos, ss, alpha, beta, rootDepth);
 
-                // search()を呼び出す
-                Value value = -search(pos, alpha, beta, rootDepth - 1, 0);
+                // 探索した指し手を評価値の高い順に並び替える
+                // fail highした指し手はpvIdx番目に来る。
+                std::stable_sort(rootMoves.begin() + pvIdx, rootMoves.end());
 
                 // 探索終了であれば返り値は信用できない
-                if (Stop)
+                if (Threads.stop)
                     break;
 
-                // 局面を1手戻す
-                pos.undo_move(move);
+                // fail lowしたなら、alphaを下げて探索しなおす。
+                // betaも少し下げておくと、次の探索でfail highしたときに再探索が少なくて済む。
+                if (bestValue <= alpha)
+                {
+                    beta = (alpha + beta) / 2;
+                    alpha = std::max(bestValue - delta, -VALUE_INFINITE);
+                }
 
-                if (value > alpha)
-                    alpha = value;
+                // fail highしたなら、betaを上げて探索しなおす。
+                else if (bestValue >= beta)
+                    beta = std::min(bestValue + delta, VALUE_INFINITE);
 
-                rootMoves[i].score = value;
+                else
+                    break;
+
+                // 窓幅を広げていく
+                delta += delta / 4 + 5;
             }
 
-            // 合法手を評価値の高い順に並び替える
-            std::stable_sort(rootMoves.begin(), rootMoves.end());
+            // 探索済みのPVの指し手を評価値の高い順に並び替える
+            std::stable_sort(rootMoves.begin(), rootMoves.begin() + pvIdx + 1);
 
-            // インクリメント
-            ++rootDepth;
+            // 読み筋を出力する。MultiPVであれば、すべてのPVを探索し終えてからまとめて出力する。
+            // 探索に時間がかかっているときは、途中経過としてPVごとに出力する。
+            if (mainThread && (Threads.stop || pvIdx + 1 == multiPV || Timeman.elapsed() > 3000))
+                std::cout << USI::pv(pos, rootDepth) << std::endl;
         }
 
-        // プレイヤが返す指し手
-        bestMove = rootMoves[0].pv[0];
+        if (!Threads.stop)
+        {
+            completedDepth = rootDepth;
+
+            SEARCH_STATS(if (mainThread) stats.depthNodes[rootDepth] = Threads.nodes_searched());
+
+            if (rootMoves[0].pv[0] != lastBestMove)
+                lastBestMove = rootMoves[0].pv[0], lastBestMoveDepth = rootDepth;
+        }
+
+        if (!mainThread)
+            continue;
 
-        // タイマースレッド終了
-        Stop = true;
-        if (timerThread != nullptr)
+        // -----------------------
+        //  思考時間の調整
+        // -----------------------
+
+        // 反復が終わるごとに、探索の安定度から今回の思考時間を決めなおし、それを超えていれば次の反復は始めない。
+        // 秒読みだけのときは、時間を残しても次の手番で使えないので、思考時間の上限まで探索する。
+        if (Search::Limits.use_time_management() && !Timeman.fixed_time() && !Threads.stop)
         {
-            timerThread->join();
-            delete timerThread;
+            const Value bestValue = rootMoves[0].score;
+
+            // 評価値が前回のgoコマンドのときや直近の反復より下がっているなら、時間を多めに使う。
+            // 変わっていなければ1.0倍、1歩(90)下がると1.3倍程度。
+            const Value previousScore = mainThread->bestPreviousScore == VALUE_INFINITE ? VALUE_ZERO : mainThread->bestPreviousScore;
+            double fallingEval = (825 + 12 * (previousScore - bestValue) + 12 * (iterValue[iterIdx] - bestValue)) / 825.0;
+            fallingEval = std::min(std::max(fallingEval, 0.5), 1.5);
+
+            // 最善手がしばらく変わっていないなら時間を減らす。前回のgoコマンドで減らした分の一部はこちらで使う。
+            timeReduction = lastBestMoveDepth + 9 < completedDepth ? 1.92 : 0.95;
+            const double reduction = (1.47 + mainThread->previousTimeReduction) / (2.32 * timeReduction);
+
+            // 最善手が何度も入れ替わっているなら時間を増やす。
+            u64 totBestMoveChanges = 0;
+            for (Thread* th : Threads)
+            {
+                totBestMoveChanges += th->bestMoveChanges;
+                th->bestMoveChanges = 0;
+            }
+            const double bestMoveInstability = 1 + 2.0 * totBestMoveChanges / Threads.size();
+
+            // 最善手の探索にノードの大部分を費やしているなら、他の指し手が明らかに悪いので時間を減らす。
+            const u64 totalNodes = std::max(nodes.load(std::memory_order_relaxed), u64(1));
+            const double highBestMoveEffort = rootMoves[0].effort * 100 / totalNodes >= 93 ? 0.76 : 1.0;
+
+            double totalTime = Timeman.optimum() * fallingEval * reduction * bestMoveInstability * highBestMoveEffort;
+
+            // 合法手が1つしかないなら、長く考える意味はない。
+            if (rootMoves.size() == 1)
+                totalTime = std::min(500.0, totalTime);
+
+            // ponder中であれば、ponderhitが来たところで探索を終了する。
+            // ponderの時間も思考時間に含めているので、ponderで読んでいた分だけ持ち時間を節約できる。
+            if (Timeman.elapsed() > totalTime)
+            {
+                if (mainThread->ponder)
+                    mainThread->stopOnPonderhit = true;
+                else
+                    Threads.stop = true;
+            }
         }
+
+        iterValue[iterIdx] = rootMoves[0].score;
+        iterIdx = (iterIdx + 1) & 3;
     }
-    /* 探索部ここまで */
 
-END:;
-    std::cout << "bestmove " << bestMove << std::endl;
+    if (mainThread)
+        mainThread->previousTimeReduction = timeReduction;
 }
 
-Value search(Position& pos, Value alpha, Value beta, int depth, int ply_from_root)
+// rootの局面の詰みをdf-pnで探す。
+// 詰みが見つかったら、その指し手をrootMovesの先頭に移して詰みのスコアとPVを設定する。
+// 詰みのスコアであれば、main threadはこのスレッドの指し手を選ぶ。
+void Thread::search_mate()
 {
-    if (depth <= 0)
-        return qsearch(pos, alpha, beta, depth, ply_from_root);
+    std::vector<Move> pv;
+    if (Mate::search(rootPos, pv) != Mate::MATE)
+        return;
 
-    StateInfo si;
+    auto it = std::find(rootMoves.begin(), rootMoves.end(), pv[0]);
+    if (it == rootMoves.end())
+        return;
+
+    std::rotate(rootMoves.begin(), it, it + 1);
+    rootMoves[0].score = mate_in(int(pv.size()));
+    rootMoves[0].pv = pv;
+    completedDepth = int(pv.size());
+
+    // 思考時間無制限でなければ、詰みが見つかった時点で探索を終了する
+    if (!Search::Limits.infinite)
+        Threads.stop_searching();
+}
+
+// rootの指し手をすべて探索して、最善の評価値を返す。
+// 最初の指し手は(alpha, beta)の窓で、2手目以降はnull windowで探索し、alphaを超えたなら通常の窓で探索しなおす。(PVS)
+template <>
+Value search<Root>(Position& pos, Search::Stack* ss, Value alpha, Value beta, int depth)
+{
+    PERF_REGION(SEARCH);
+
+    Thread* thisThread = pos.this_thread();
+    Search::RootMoves& rootMoves = thisThread->rootMoves;
+    const size_t pvIdx = thisThread->pvIdx;
+
+    Value bestValue = -VALUE_INFINITE;
+
+    // MultiPVで、すでに探索したPVの指し手(pvIdxより前)は除く
+    for (size_t i = pvIdx; i < rootMoves.size(); ++i)
+    {
+        Move move = rootMoves[i].pv[0];
+        ss->currentMove = move;
+        ss->continuationHistory = &thisThread->continuationHistory[pos.moved_piece_after(move)][move_to(move)];
+        ss->moveCount = int(i - pvIdx) + 1;
+
+        // この指し手以下の探索に費やしたノード数を計るために、探索前のノード数を覚えておく
+        const u64 nodeCount = thisThread->nodes.load(std::memory_order_relaxed);
+
+        // 局面を1手進める
+        pos.do_move(move, *ss->st);
+
+        // 子局面のPV。通常の窓で探索したときだけ格納される。
+        (ss + 1)->pv[0] = MOVE_NONE;
+
+        // search()を呼び出す
+        Value value;
+        if (i == pvIdx)
+            value = -search<PV>(pos, ss + 1, -beta, -alpha, depth - 1);
+        else
+        {
+            value = -search<NonPV>(pos, ss + 1, -(alpha + 1), -alpha, depth - 1);
+
+            if (value > alpha && value < beta)
+                value = -search<PV>(pos, ss + 1, -beta, -alpha, depth - 1);
+        }
+
+        // 局面を1手戻す
+        pos.undo_move(move);
+
+        rootMoves[i].effort += thisThread->nodes.load(std::memory_order_relaxed) - nodeCount;
+
+        // 探索終了であれば返り値は信用できない
+        if (Threads.stop)
+            break;
+
+        // 最初の指し手とalphaを更新した指し手以外の評価値は上界でしかないので-VALUE_INFINITEにしておく。
+        // PVの評価値であれば、子局面のPVをこの指し手のPVとしてコピーしておく。
+        Search::RootMove& rm = rootMoves[i];
+        if (i == pvIdx || value > alpha)
+        {
+            rm.score = value;
+            rm.selDepth = thisThread->selDepth;
+            rm.pv.resize(1);
+            for (Move* m = (ss + 1)->pv; *m != MOVE_NONE; ++m)
+                rm.pv.push_back(*m);
+        }
+        else
+            rm.score = -VALUE_INFINITE;
+
+        // 2番目以降の指し手が最善手になった(MultiPVの2番目以降のPVの探索は除く)
+        if (i > pvIdx && pvIdx == 0 && value > alpha)
+            ++thisThread->bestMoveChanges;
+
+        if (value > bestValue)
+        {
+            bestValue = value;
+
+            if (value > alpha)
+            {
+                alpha = value;
+
+                // fail high
+                if (alpha >= beta)
+                    break;
+            }
+        }
+    }
+
+    return bestValue;
+}
+
+template <NodeType nodeType>
+Value search(Position& pos, Search::Stack* ss, Value alpha, Value beta, int depth)
+{
+    constexpr bool PvNode = nodeType == PV;
+    ASSERT_LV3(PvNode || alpha == beta - 1);
+
+    if (depth <= 0)
+        return qsearch<nodeType>(pos, ss, alpha, beta, depth);
 
     // この局面でdo_move()された合法手の数
     int moveCount = 0;
 
+    // この局面で王手がかかっているか
+    const bool inCheck = pos.in_check();
+
     // 千日手の検出
     RepetitionState draw_type = pos.is_repetition();
     if (draw_type != REPETITION_NONE)
         return draw_value(draw_type, pos.side_to_move());
 
-    for (ExtMove m : MoveList<LEGAL>(pos))
+    // 最大手数に到達したら評価関数の値を返す
+    if (ss->ply >= MAX_PLY)
+        return Eval::evaluate(pos);
+
+    Thread* thisThread = pos.this_thread();
+
+    // 思考時間の上限か、指定されたノード数に達していれば探索を終了させる
+    if (thisThread == Threads.main())
+        static_cast<MainThread*>(thisThread)->check_time();
+
+    // 選択深さを更新する
+    if (PvNode && thisThread->selDepth < ss->ply + 1)
+        thisThread->selDepth = ss->ply + 1;
+
+    // 探索が終了していれば、返り値は使われないので何もせずに返る
+    if (Threads.stop.load(std::memory_order_relaxed))
+        return VALUE_ZERO;
+
+    // 2手先のkillerは、この局面の子の兄弟局面でのものとして使うので、ここでクリアしておく。
+    (ss + 2)->killers[0] = (ss + 2)->killers[1] = MOVE_NONE;
+
+    // singular extensionの判定のための探索中であれば、除外する指し手
+    Move excludedMove = ss->excludedMove;
+
+    // 置換表のprobe
+    // 指し手を除外した探索の結果は通常の探索の結果とは異なるので、別の局面として扱う。
+    Key posKey = pos.key() ^ (Key(excludedMove) << 16);
+    bool ttHit;
+    TTData ttData;
+    TTEntry* tte = TT.probe(posKey, ttHit, ttData);
+    Value ttValue = value_from_tt(ttData.value, ss->ply);
+    Move ttMove = ttHit ? pos.to_move(ttData.move) : MOVE_NONE;
+
+    SEARCH_STATS(++thisThread->stats.mainNodes, ++thisThread->stats.ttProbes, thisThread->stats.ttHits += ttHit);
+
+    // 置換表の値で枝刈りする
+    // 真の値であるか、上界(下界)がalpha(beta)を超えない(下回らない)ことが確定しているならそれを返せば良い。
+    if (ttHit
+        && ttData.depth >= depth
+        && ttValue != VALUE_NONE
+        && (ttData.bound == BOUND_EXACT
+            || ((ttData.bound & BOUND_LOWER) && ttValue >= beta)
+            || ((ttData.bound & BOUND_UPPER) && ttValue <= alpha)))
+    {
+        SEARCH_STATS(++thisThread->stats.ttCutoffs);
+        return ttValue;
+    }
+
+    // -----------------------
+    //  1手詰め、3手詰め
+    // -----------------------
+
+    // non PV nodeでは、指し手を生成する前に短手数の詰みを調べる。詰みがあればそのスコアを返す。
+    // 1手詰めより短い詰みはないので、1手詰めのスコアは真の値。3手詰めは(見逃した1手詰めがあるかもしれないので)下界。
+    if (!PvNode && !inCheck && !excludedMove)
+    {
+        Move mateMove = pos.mate1ply();
+        int matePly = 1;
+
+        if (!mateMove && !ttHit && depth >= Mate3plyDepth)
+        {
+            mateMove = pos.mate3ply();
+            matePly = 3;
+        }
+
+        if (mateMove)
+        {
+            const Value mateValue = mate_in(ss->ply + matePly);
+            tte->save(posKey, value_to_tt(mateValue, ss->ply), false, matePly == 1 ? BOUND_EXACT : BOUND_LOWER,
+                std::min(MAX_PLY - 1, depth + 6), mateMove, VALUE_NONE);
+            return mateValue;
+        }
+    }
+
+    // -----------------------
+    //  評価関数の値
+    // -----------------------
+
+    Value eval;
+    if (inCheck)
+        ss->staticEval = eval = VALUE_NONE;
+
+    else
     {
+        // 置換表に評価関数の値が格納されていればそれを使う
+        ss->staticEval = eval = (ttHit && ttData.eval != VALUE_NONE) ? ttData.eval : Eval::evaluate(pos);
+
+        // 置換表の値のほうが正確な評価値であるならそちらを使う
+        if (ttHit
+            && ttValue != VALUE_NONE
+            && (ttData.bound & (ttValue > eval ? BOUND_LOWER : BOUND_UPPER)))
+            eval = ttValue;
+    }
+
+    // 2手前の局面より評価値が改善しているか
+    const bool improving = ss->staticEval >= (ss - 2)->staticEval || (ss - 2)->staticEval == VALUE_NONE;
+
+    // -----------------------
+    //  razoring
+    // -----------------------
+
+    // 残り1手で評価値がalphaを大きく下回っているなら、静止探索の値を返す。
+    if (!PvNode
+        && !inCheck
+        && depth == 1
+        && eval <= alpha - RazoringMargin)
+        return qsearch<NonPV>(pos, ss, alpha, beta, 0);
+
+    // -----------------------
+    //  reverse futility pruning
+    // -----------------------
+
+    // 残り深さが浅く、評価値がbetaを大きく上回っているなら、相手が何を指してもbetaを下回らないとみなして枝刈りする。
+    if (!PvNode
+        && !inCheck
+        && depth < 7
+        && eval - futility_margin(depth, improving) >= beta
+        && eval < VALUE_MATE_IN_MAX_PLY)
+        return eval;
+
+    // -----------------------
+    //  null move pruning
+    // -----------------------
+
+    // 手番を相手に渡して(パスして)も、浅い探索でbetaを超えるなら、この局面はbetaを超えるとみなして枝刈りする。
+    if (!PvNode
+        && !inCheck
+        && !excludedMove
+        && (ss - 1)->currentMove != MOVE_NULL
+        && eval >= beta
+        && ss->staticEval >= beta
+        && (ss->ply >= thisThread->nmpMinPly || pos.side_to_move() != thisThread->nmpColor))
+    {
+        // 削減する深さは、深さとbetaを超えている量に応じて決める
+        int R = (823 + 67 * depth) / 256 + std::min(int(eval - beta) / (2 * int(Eval::PawnValue)), 3);
+
+        ss->currentMove = MOVE_NULL;
+        ss->continuationHistory = &thisThread->continuationHistory[NO_PIECE][0];
+
+        SEARCH_STATS(++thisThread->stats.nullMoveTries);
+
+        pos.do_null_move(*ss->st);
+        Value nullValue = -search<NonPV>(pos, ss + 1, -beta, -beta + 1, depth - R);
+        pos.undo_null_move();
+
+        if (nullValue >= beta)
+        {
+            SEARCH_STATS(++thisThread->stats.nullMoveCutoffs);
+
+            // 詰みのスコアは信用できないので返さない
+            if (nullValue >= VALUE_MATE_IN_MAX_PLY)
+                nullValue = beta;
+
+            if (thisThread->nmpMinPly || (abs(beta) < VALUE_MATE_IN_MAX_PLY && depth < 12))
+                return nullValue;
+
+            // 深い探索では、null moveを禁止して同じ深さで検証探索を行う。
+            // 検証探索中は、plyがnmpMinPlyに達するまで、この手番側のnull moveを行わない。
+            thisThread->nmpMinPly = ss->ply + 3 * (depth - R) / 4;
+            thisThread->nmpColor = pos.side_to_move();
+
+            Value v = search<NonPV>(pos, ss, beta - 1, beta, depth - R);
+
+            thisThread->nmpMinPly = 0;
+
+            if (v >= beta)
+                return nullValue;
+        }
+    }
+
+    // このnodeで得られた最善の評価値と指し手
+    Value bestValue = -VALUE_INFINITE;
+    Move bestMove = MOVE_NONE;
+
+    // 直前の指し手に対するcounter move
+    Move prevMove = (ss - 1)->currentMove;
+    Square prevSq = move_to(prevMove);
+    Move counterMove = is_ok(prevMove) ? thisThread->counterMoves[pos.piece_on(prevSq)][prevSq] : MOVE_NONE;
+
+    // 1手前、2手前の指し手に対応するcontinuation history
+    const PieceToHistory* contHist[] = { (ss - 1)->continuationHistory, (ss - 2)->continuationHistory };
+
+    // 最善手より前に探索した指し手。historyの減点に使う。
+    Move capturesSearched[32], quietsSearched[64];
+    int captureCount = 0, quietCount = 0;
+
+    // move count pruningによって、残りの静かな指し手を生成しないか
+    bool moveCountPruning = false;
+
+    MovePicker mp(pos, ttMove, depth, &thisThread->mainHistory, &thisThread->captureHistory,
+        contHist, counterMove, ss->killers);
+    Move move;
+    while ((move = mp.nextMove(moveCountPruning)) != MOVE_NONE)
+    {
+        if (move == excludedMove)
+            continue;
+
+        // MovePickerは擬似合法手を返すので、合法かを確認する
+        if (!pos.legal(move))
+            continue;
+
+        bool captureOrPawnPromotion = pos.capture_or_pawn_promotion(move);
+        bool givesCheck = pos.gives_check(move);
+        Piece movedPiece = pos.moved_piece_after(move);
+
+        // -----------------------
+        //  浅い深さでの枝刈り
+        // -----------------------
+
+        // 詰まされる局面でなく、すでに1手以上探索しているなら、良い指し手である見込みの低い指し手を枝刈りする。
+        if (!PvNode && bestValue > VALUE_MATED_IN_MAX_PLY)
+        {
+            moveCountPruning = moveCount >= futility_move_count(improving, depth);
+
+            if (!captureOrPawnPromotion && !givesCheck)
+            {
+                // move count pruning
+                if (moveCountPruning)
+                    continue;
+
+                // LMRで削減したあとの深さ
+                int lmrDepth = std::max(depth - 1 - reduction(improving, depth, moveCount), 0);
+
+                // futility pruning : この指し手で評価値が上がる見込みの量を加えてもalphaに届かない
+                if (!inCheck
+                    && lmrDepth < 7
+                    && ss->staticEval + FutilityMarginQuiet * (lmrDepth + 1) <= alpha)
+                    continue;
+
+                // SEEで大きく駒損する指し手
+                if (!pos.see_ge(move, Value(-29 * lmrDepth * lmrDepth)))
+                    continue;
+            }
+
+            // 駒を取る指し手、王手をかける指し手は、SEEで大きく駒損するなら枝刈りする。
+            else if (depth < 7 && !pos.see_ge(move, Value(-int(Eval::PawnValue) * 2 * depth)))
+                continue;
+        }
+
+        // -----------------------
+        //  延長
+        // -----------------------
+
+        int extension = 0;
+
+        // singular extension
+        // 置換表の指し手だけがbetaを超えそうで、他の指し手はすべて大きく劣るなら、置換表の指し手を1手延長する。
+        // 置換表の指し手を除外して、置換表の値より少し低い窓で浅く探索し、それを超えないことで確かめる。
+        if (depth >= 8
+            && move == ttMove
+            && !excludedMove
+            && abs(ttValue) < VALUE_MATE_IN_MAX_PLY
+            && (ttData.bound & BOUND_LOWER)
+            && ttData.depth >= depth - 3)
+        {
+            Value singularBeta = ttValue - 2 * depth;
+
+            ss->excludedMove = move;
+            Value v = search<NonPV>(pos, ss, singularBeta - 1, singularBeta, depth / 2);
+            ss->excludedMove = MOVE_NONE;
+
+            if (v < singularBeta)
+                extension = 1;
+
+            // 置換表の指し手以外にもbetaを超える指し手があるなら、この局面はbetaを超えるとみなす。(multi-cut)
+            else if (singularBeta >= beta)
+                return singularBeta;
+        }
+
+        // 王手延長
+        // 駒損しない王手は1手延長する。
+        else if (givesCheck && pos.see_ge(move))
+            extension = 1;
+
+        ss->currentMove = move;
+        ss->continuationHistory = &thisThread->continuationHistory[movedPiece][move_to(move)];
+
         // 局面を1手進める
-        pos.do_move(m.move, si);
-        ++moveCount;
+        pos.do_move(move, *ss->st, givesCheck);
+        ss->moveCount = ++moveCount;
+
+        // 子局面のPV。通常の窓で探索したときだけ格納される。
+        if (PvNode)
+            (ss + 1)->pv[0] = MOVE_NONE;
+
+        Value value = -VALUE_INFINITE;
+        int newDepth = depth - 1 + extension;
+        bool doFullDepthSearch;
+
+        // -----------------------
+        //  Late Move Reduction
+        // -----------------------
+
+        // 後ろのほうの静かな指し手は、良い指し手である可能性が低いので、深さを削減してnull windowで探索する。
+        // alphaを超えたなら、削減せずに探索しなおす。
+        if (depth >= 3 && moveCount > 1 && !captureOrPawnPromotion)
+        {
+            int r = reduction(improving, depth, moveCount);
 
-        // 再帰的にsearch()を呼び出す
-        Value value = -search(pos, -beta, -alpha, depth - 1, ply_from_root + 1);
+            // PV nodeや、王手をかける指し手、王手を回避する指し手は削減量を減らす
+            if (PvNode)
+                r--;
+
+            if (givesCheck || inCheck)
+                r--;
+
+            // historyの値が良い指し手ほど削減量を減らす
+            int statScore = thisThread->mainHistory[~pos.side_to_move()][from_to(move)]
+                + (*contHist[0])[movedPiece][move_to(move)]
+                + (*contHist[1])[movedPiece][move_to(move)]
+                - 4000;
+            r -= statScore / 16384;
+
+            int d = std::clamp(newDepth - r, 1, newDepth);
+
+            value = -search<NonPV>(pos, ss + 1, -(alpha + 1), -alpha, d);
+
+            doFullDepthSearch = value > alpha && d != newDepth;
+
+            SEARCH_STATS(++thisThread->stats.lmrSearches, thisThread->stats.lmrResearches += doFullDepthSearch);
+        }
+        else
+            doFullDepthSearch = !PvNode || moveCount > 1;
+
+        // -----------------------
+        //  PVS(Principal Variation Search)
+        // -----------------------
+
+        // 最初の指し手以外はnull windowで探索して、alphaを超えないことを確かめる。
+        if (doFullDepthSearch)
+            value = -search<NonPV>(pos, ss + 1, -(alpha + 1), -alpha, newDepth);
+
+        // PV nodeで最初の指し手か、null windowでalphaを超えたなら、通常の窓で探索しなおす。
+        if (PvNode && (moveCount == 1 || (value > alpha && value < beta)))
+            value = -search<PV>(pos, ss + 1, -beta, -alpha, newDepth);
 
         // 局面を1手戻す
-        pos.undo_move(m.move);
+        pos.undo_move(move);
 
         // 探索の終了
-        if (Search::Stop)
+        if (Threads.stop)
             return VALUE_ZERO;
 
-        if (value > alpha)
+        if (value > bestValue)
         {
-            alpha = value;
-            if (alpha >= beta)
-                break;
+            bestValue = value;
+
+            if (value > alpha)
+            {
+                bestMove = move;
+
+                if (PvNode)
+                    update_pv(ss->pv, move, (ss + 1)->pv);
+
+                alpha = value;
+                if (alpha >= beta)
+                {
+                    SEARCH_STATS(++thisThread->stats.betaCutoffs, thisThread->stats.firstMoveCutoffs += moveCount == 1);
+                    break;
+                }
+            }
+        }
+
+        if (move != bestMove)
+        {
+            if (captureOrPawnPromotion && captureCount < 32)
+                capturesSearched[captureCount++] = move;
+
+            else if (!captureOrPawnPromotion && quietCount < 64)
+                quietsSearched[quietCount++] = move;
         }
     }
 
+    // 合法手がなければ詰み。ただし、指し手を除外した探索であれば、除外した指し手があるのでalphaを返す。
     if (moveCount == 0)
-        return mated_in(ply_from_root);
+        bestValue = excludedMove ? alpha : mated_in(ss->ply);
 
-    return alpha;
+    // 最善手が見つかったなら、historyなどを更新する
+    else if (bestMove)
+    {
+        if (!pos.capture_or_pawn_promotion(bestMove))
+            update_quiet_stats(pos, ss, bestMove, quietsSearched, quietCount, stat_bonus(depth));
+
+        update_capture_stats(pos, bestMove, capturesSearched, captureCount, stat_bonus(depth));
+
+        // 1手前の指し手が、その局面で最初に探索した静かな指し手であったのに、ここで咎められたなら減点する。
+        if ((ss - 1)->moveCount == 1 && !pos.state()->capturedPiece)
+            update_continuation_histories(ss - 1, pos.piece_on(prevSq), prevSq, -stat_bonus(depth + 1));
+    }
+
+    // どの指し手もalphaを超えなかったなら、この局面に至った1手前の指し手を加点する。
+    else if (depth >= 3 && !pos.state()->capturedPiece && is_ok(prevMove))
+        update_continuation_histories(ss - 1, pos.piece_on(prevSq), prevSq, stat_bonus(depth));
+
+    // 置換表に保存する
+    // betaを超えたならこの値以上(下界)、alphaを更新できたなら真の値、さもなくばこの値以下(上界)である。
+    tte->save(posKey, value_to_tt(bestValue, ss->ply), false,
+        bestValue >= beta ? BOUND_LOWER : bestMove ? BOUND_EXACT : BOUND_UPPER,
+        depth, bestMove, ss->staticEval);
+
+    return bestValue;
 }
 
 // 静止探索
-Value qsearch(Position& pos, Value alpha, Value beta, int depth, int ply_from_root)
+template <NodeType nodeType>
+Value qsearch(Position& pos, Search::Stack* ss, Value alpha, Value beta, int depth)
 {
+    constexpr bool PvNode = nodeType == PV;
+    ASSERT_LV3(PvNode || alpha == beta - 1);
+
     // この局面で王手がかかっているか
     bool InCheck = pos.in_check();
 
-    Value value;
+    // 思考時間の上限か、指定されたノード数に達していれば探索を終了させる
+    if (pos.this_thread() == Threads.main())
+        Threads.main()->check_time();
+
+    if (Threads.stop.load(std::memory_order_relaxed))
+        return VALUE_ZERO;
+
+    // 千日手の検出
+    RepetitionState draw_type = pos.is_repetition();
+    if (draw_type != REPETITION_NONE)
+        return draw_value(draw_type, pos.side_to_move());
+
+    // 最大手数に到達したら評価関数の値を返す
+    if (ss->ply >= MAX_PLY)
+        return InCheck ? VALUE_ZERO : Eval::evaluate(pos);
+
+    // 置換表のprobe
+    Key posKey = pos.key();
+    bool ttHit;
+    TTData ttData;
+    TTEntry* tte = TT.probe(posKey, ttHit, ttData);
+    Value ttValue = value_from_tt(ttData.value, ss->ply);
+    Move ttMove = ttHit ? pos.to_move(ttData.move) : MOVE_NONE;
+
+    SEARCH_STATS(Search::Stats& stats = pos.this_thread()->stats;
+                 ++stats.qNodes, ++stats.ttProbes, stats.ttHits += ttHit);
+
+    if (ttHit
+        && ttData.depth >= depth
+        && ttValue != VALUE_NONE
+        && (ttData.bound == BOUND_EXACT
+            || ((ttData.bound & BOUND_LOWER) && ttValue >= beta)
+            || ((ttData.bound & BOUND_UPPER) && ttValue <= alpha)))
+    {
+        SEARCH_STATS(++stats.ttCutoffs);
+        return ttValue;
+    }
+
+    // このnodeで得られた最善の評価値と指し手
+    Value bestValue;
+    Move bestMove = MOVE_NONE;
+
+    // 評価関数の値
+    Value eval = VALUE_NONE;
+
     if (InCheck)
     {
         // 王手がかかっているならすべての指し手を調べる
-        alpha = -VALUE_INFINITE;
+        bestValue = -VALUE_INFINITE;
     }
     else
     {
         // この局面で何も指さないときの評価値
         // ここで評価関数を呼び出す
-        value = Eval::evaluate(pos);
+        bestValue = eval = Eval::evaluate(pos);
 
-        if (alpha < value)
+        if (bestValue >= beta)
         {
-            alpha = value;
-            if (alpha >= beta)
-                return alpha; // 枝刈り
+            // 枝刈り
+            if (!ttHit)
+                tte->save(posKey, value_to_tt(bestValue, ss->ply), false, BOUND_LOWER,
+                    depth, MOVE_NONE, eval);
+            return bestValue;
         }
 
+        if (bestValue > alpha)
+            alpha = bestValue;
+
         // これ以上探索を延長しない
         // ここでは適当に-3とした
         if (depth < -3)
-            return alpha;
-    }
+            return bestValue;
 
-    // do_move()で必要
-    StateInfo si;
+        // 直前の指し手がnull moveなら、取り返す駒はない
+        if (!is_ok(pos.state()->lastMove))
+            return bestValue;
+    }
 
     // この局面でdo_move()された合法手の数
     int move_count = 0;
 
-    // 千日手の検出
-    RepetitionState draw_type = pos.is_repetition();
-    if (draw_type != REPETITION_NONE)
-        return draw_value(draw_type, pos.side_to_move());
+    Thread* thisThread = pos.this_thread();
+
+    // 選択深さを更新する
+    if (PvNode && thisThread->selDepth < ss->ply + 1)
+        thisThread->selDepth = ss->ply + 1;
+
+    // 1手前、2手前の指し手に対応するcontinuation history
+    const PieceToHistory* contHist[] = { (ss - 1)->continuationHistory, (ss - 2)->continuationHistory };
 
-    MovePicker mp(pos, move_to(pos.state()->lastMove));
+    MovePicker mp(pos, ttMove, &thisThread->mainHistory, &thisThread->captureHistory,
+        contHist, move_to(pos.state()->lastMove));
     Move move;
     while ((move = mp.nextMove()) != MOVE_NONE)
     {
-        // LEGAL, LEAGL_ALL以外で指し手生成しているため
-        // 合法かを確認する
+        // 詰まされる局面でないなら、SEEで駒損する指し手は探索しない
+        if (bestValue > VALUE_MATED_IN_MAX_PLY && !pos.see_ge(move))
+            continue;
+
+        // MovePickerは擬似合法手を返すので、合法かを確認する
         if (!pos.legal(move))
             continue;
 
+        ss->currentMove = move;
+        ss->continuationHistory = &thisThread->continuationHistory[pos.moved_piece_after(move)][move_to(move)];
+
         // 局面を1手進める
-        pos.do_move(move, si);
+        pos.do_move(move, *ss->st);
         ++move_count;
 
+        // 子局面のPV
+        if (PvNode)
+            (ss + 1)->pv[0] = MOVE_NONE;
+
         // 再帰的にqsearch()を呼び出す
-        Value value = -qsearch(pos, -beta, -alpha, depth - 1, ply_from_root + 1);
+        Value value = -qsearch<nodeType>(pos, ss + 1, -beta, -alpha, depth - 1);
 
         // 局面を1手戻す
         pos.undo_move(move);
 
         // 探索の終了
-        if (Search::Stop)
+        if (Threads.stop)
             return VALUE_ZERO;
 
-        if (value > alpha)
+        if (value > bestValue)
         {
-            alpha = value;
-            if (alpha >= beta)
-                break;
+            bestValue = value;
+
+            if (value > alpha)
+            {
+                bestMove = move;
+
+                if (PvNode)
+                    update_pv(ss->pv, move, (ss + 1)->pv);
+
+                alpha = value;
+                if (alpha >= beta)
+                    break;
+            }
         }
     }
 
     // 王手されていて，do_move()した数が0なら詰んでいる
     // 詰みのスコアを返す
     if (InCheck && move_count == 0)
-        return mated_in(ply_from_root);
+        return mated_in(ss->ply);
+
+    tte->save(posKey, value_to_tt(bestValue, ss->ply), false,
+        bestValue >= beta ? BOUND_LOWER : bestMove ? BOUND_EXACT : BOUND_UPPER,
+        depth, bestMove, eval);
 
-    return alpha;
+    return bestValue;
 }
\ No newline at end of file
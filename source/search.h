@@ -4,6 +4,14 @@
 #include "misc.h"
 #include <vector>
 #include "position.h"
+#include "movepick.h"
+
+// 探索の統計情報(Search::Stats)を集計するコード。USE_SEARCH_STATSがdefineされていなければ何も生成しない。
+#if defined(USE_SEARCH_STATS)
+#define SEARCH_STATS(...) __VA_ARGS__
+#else
+#define SEARCH_STATS(...)
+#endif
 
 namespace Search
 {
@@ -17,6 +25,9 @@ namespace Search
 
     bool operator==(const Move& m) const { return pv[0] == m; }
 
+    // 置換表からponderの指し手を取り出してpv[1]に設定する。取り出せたらtrueを返す。
+    bool extract_ponder_from_tt(Position& pos);
+
     bool operator<(const RootMove& m) const
     {
       return m.score != score
@@ -33,20 +44,48 @@ namespace Search
     // rootから最大、何手目まで探索したか(選択深さの最大)
     int selDepth = 0;
 
+    // この指し手以下の探索に費やしたノード数。(今回のgoコマンドでの累計)
+    // 最善手にノードの大部分を費やしているなら、最善手が明らかな局面として思考時間を減らす。
+    u64 effort = 0;
+
     // この指し手で進めたときのpv
     std::vector <Move> pv;
   };
 
   typedef std::vector<RootMove> RootMoves;
 
-  // 探索開始局面で思考対象とする指し手の集合。
-  extern RootMoves rootMoves;
+  // 探索中に、rootからの手数(ply)ごとに保持しておく情報
+  struct Stack
+  {
+    // rootからの手数
+    int ply;
+
+    // このplyで現在探索している指し手
+    Move currentMove;
+
+    // singular extensionの判定のための探索で、この局面で除外する指し手
+    Move excludedMove;
+
+    // このplyでbeta cutoffを起こした静かな指し手
+    Move killers[2];
 
-  // 今回のgoコマンドでの探索ノード数。
-  extern uint64_t Nodes;
+    // このplyでdo_move()した指し手の数
+    int moveCount;
 
-  // 探索中にこれがtrueになったら探索を即座に終了すること。
-  extern bool Stop;
+    // この局面での評価関数の値(王手がかかっているときはVALUE_NONE)
+    Value staticEval;
+
+    // currentMoveに対応するContinuationHistoryの要素
+    PieceToHistory* continuationHistory;
+
+    // この局面からdo_move()、do_null_move()するときに用いるStateInfo。
+    // 探索のたびにstackに確保しないように、Thread::statesの要素を指しておく。
+    StateInfo* st;
+
+    // この局面からのPV(最善応手列)。MOVE_NONEで終端する。PV nodeでだけ更新される。
+    // plyの局面のPVは、alphaを更新した指し手のあとにply + 1の局面のPVを連結したもの。(triangular PV table)
+    Move pv[MAX_PLY + 1];
+  };
 
   // goコマンドでの探索時に用いる、持ち時間設定などが入った構造体
   struct LimitsType {
@@ -54,6 +93,7 @@ namespace Search
       time[WHITE] = time[BLACK] = inc[WHITE] = inc[BLACK] = movetime = TimePoint(0);
       depth = perft = infinite = 0;
       nodes = 0;
+      mate = 0;
       byoyomi[WHITE] = byoyomi[BLACK] = TimePoint(0);
     }
 
@@ -61,7 +101,7 @@ namespace Search
     // 詰み専用探索、思考時間0、探索深さが指定されている、探索ノードが指定されている、思考時間無制限
     // であるときは、時間制御に意味がないのでやらない。
     bool use_time_management() const {
-      return !(movetime | depth | nodes | perft | infinite);
+      return !(mate | movetime | depth | nodes | perft | infinite);
     }
 
     // time[]   : 残り時間(ms換算で)
@@ -79,21 +119,54 @@ namespace Search
 
     // 秒読み(ms換算で)
     TimePoint byoyomi[COLOR_NB];
+
+    // 詰み専用探索(go mate)の思考時間(ms換算で)。"go mate infinite"ならINT64_MAX。0なら通常の探索。
+    TimePoint mate;
+
+    // rootで探索する指し手をこれに限る(go searchmoves)。空ならすべての合法手を探索する。
+    std::vector<Move> searchmoves;
   };
 
   extern LimitsType Limits;
 
+  // 探索の統計情報。探索が遅い原因(枝刈りや置換表が効いているかなど)を調べるのに用いる。
+  // 各スレッドが探索中にThread::statsに加算し、goコマンドの探索が終わったところで
+  // main threadがすべてのスレッドの分を合計してLastStatsに格納する。USIの拡張コマンド"stats"で出力できる。
+  // config.hでUSE_SEARCH_STATSをdefineしたときだけ集計する。defineしなければ、集計のコードはSEARCH_STATS()で取り除かれる。
+  struct Stats
+  {
+    // search()、qsearch()を呼び出したnodeの数
+    u64 mainNodes, qNodes;
+
+    // 置換表をprobeした回数、hitした回数、置換表の値で枝刈りした回数(search()、qsearch()の合計)
+    u64 ttProbes, ttHits, ttCutoffs;
+
+    // search()でbeta cutoffが起きた回数と、そのうち最初の指し手で起きた回数
+    u64 betaCutoffs, firstMoveCutoffs;
+
+    // null moveを試した回数と、null moveの探索がbetaを超えた回数
+    u64 nullMoveTries, nullMoveCutoffs;
+
+    // LMRで深さを削減して探索した回数と、alphaを超えたので削減せずに探索しなおした回数
+    u64 lmrSearches, lmrResearches;
+
+    // main threadが反復深化で深さdの探索を終えたときの(全スレッドの)累計node数。分岐係数を求めるのに用いる。
+    u64 depthNodes[MAX_PLY];
+
+    Stats& operator+=(const Stats& s);
+
+    // "info string"として出力する。
+    void print() const;
+  };
+
+  // 前回のgoコマンドでの探索の統計情報
+  extern Stats LastStats;
+
   // 探索部の初期化
   void init();
 
   // 探索部のclear
   void clear();
-
-  // 探索を開始する
-  void start_thinking(const Position& rootPos, StateListPtr& states, LimitsType limits);
-  
-  // 探索本体
-  void search(Position& rootPos);
 }
 
 #endif // !SEARCH_H_
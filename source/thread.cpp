@@ -0,0 +1,207 @@
+﻿#include <algorithm>
+
+#include "thread.h"
+#include "usi.h"
+
+// スレッドプール。global object。
+ThreadPool Threads;
+
+// ----------------------------------
+//           Thread
+// ----------------------------------
+
+// スレッドを起動して、idle_loop()に入るまで待つ。
+Thread::Thread(size_t n) : idx(n), stdThread(&Thread::idle_loop, this)
+{
+	wait_for_search_finished();
+}
+
+// exitフラグを立てて、スレッドの終了を待つ。
+// 探索中にこのデストラクタを呼び出してはならない。
+Thread::~Thread()
+{
+	ASSERT_LV1(!searching);
+
+	exit = true;
+	start_searching();
+	stdThread.join();
+}
+
+void Thread::clear()
+{
+	mainHistory.fill(0);
+	captureHistory.fill(0);
+	counterMoves.fill(MOVE_NONE);
+
+	for (auto& to : continuationHistory)
+		for (auto& h : to)
+			h->fill(0);
+}
+
+void Thread::start_searching()
+{
+	std::lock_guard<std::mutex> lk(mutex);
+	searching = true;
+	cv.notify_one(); // idle_loop()で待機しているのを起こす。
+}
+
+void Thread::wait_for_search_finished()
+{
+	std::unique_lock<std::mutex> lk(mutex);
+	cv.wait(lk, [&] { return !searching; });
+}
+
+void Thread::idle_loop()
+{
+	while (true)
+	{
+		std::unique_lock<std::mutex> lk(mutex);
+		searching = false;
+		cv.notify_one(); // wait_for_search_finished()で待機しているのを起こす。
+		cv.wait(lk, [&] { return searching; });
+
+		if (exit)
+			return;
+
+		lk.unlock();
+
+		search();
+	}
+}
+
+// ----------------------------------
+//        ThreadPool
+// ----------------------------------
+
+void ThreadPool::set(size_t requested)
+{
+	if (size() > 0)
+	{
+		// 既存のスレッドをすべて解体する。
+		main()->wait_for_search_finished();
+
+		while (size() > 0)
+			delete back(), pop_back();
+	}
+
+	if (requested > 0)
+	{
+		push_back(new MainThread(0));
+
+		while (size() < requested)
+			push_back(new Thread(size()));
+
+		clear();
+	}
+}
+
+void ThreadPool::clear()
+{
+	for (Thread* th : *this)
+		th->clear();
+
+	main()->bestPreviousScore = VALUE_INFINITE;
+	main()->previousTimeReduction = 1.0;
+}
+
+u64 ThreadPool::nodes_searched() const
+{
+	u64 nodes = 0;
+	for (Thread* th : *this)
+		nodes += th->nodes.load(std::memory_order_relaxed);
+	return nodes;
+}
+
+void ThreadPool::wait_for_stop(TimePoint deadline)
+{
+	std::unique_lock<std::mutex> lk(stopMutex);
+
+	// ponderhitで通常の探索に切り替わったなら、思考時間無制限でない限り待つ必要はない。
+	auto stopped = [&] { return stop.load() || (!main()->ponder && !Search::Limits.infinite); };
+
+	if (deadline == INT64_MAX)
+		stopCv.wait(lk, stopped);
+	else
+		stopCv.wait_for(lk, std::chrono::milliseconds(std::max(deadline - Time.elapsed(), TimePoint(0))), stopped);
+
+	stop = true;
+}
+
+void ThreadPool::ponderhit()
+{
+	std::lock_guard<std::mutex> lk(stopMutex);
+	main()->ponder = false;
+	stopCv.notify_all();
+}
+
+void ThreadPool::stop_searching()
+{
+	std::lock_guard<std::mutex> lk(stopMutex);
+	stop = true;
+	stopCv.notify_all();
+}
+
+void ThreadPool::start_searching()
+{
+	for (Thread* th : *this)
+		if (th != front())
+			th->start_searching();
+}
+
+void ThreadPool::wait_for_search_finished() const
+{
+	for (Thread* th : *this)
+		if (th != front())
+			th->wait_for_search_finished();
+}
+
+// main threadを起こして探索を開始する。
+// 探索の終了を待たずに戻るので、探索中もUSIのコマンドを受け付けることができる。
+void ThreadPool::start_thinking(const Position& pos, StateListPtr& states, const Search::LimitsType& limits, bool ponderMode)
+{
+	main()->wait_for_search_finished();
+
+	stop = false;
+	main()->ponder = main()->ponderhitPending = ponderMode;
+	main()->stopOnPonderhit = false;
+
+	Search::Limits = limits;
+
+	// 最初のcheck_time()の呼び出しで時刻を調べるようにしておく
+	main()->callsCnt = 0;
+
+	// go searchmovesで指定された指し手があれば、rootの指し手をそれに限る。
+	Search::RootMoves rootMoves;
+	for (Move move : MoveList<LEGAL_ALL>(pos))
+		if (limits.searchmoves.empty()
+			|| std::count(limits.searchmoves.begin(), limits.searchmoves.end(), move))
+			rootMoves.emplace_back(move);
+
+	// statesがnullptrなら前回のものを使い回す。
+	ASSERT_LV3(states.get() || setupStates.get());
+
+	if (states.get())
+		setupStates = std::move(states);
+
+	// 各スレッドにrootPosとrootMovesを設定する。
+	// rootStateは、setup movesの末尾のStateInfoをコピーしておけば千日手の判定のために局面を遡ることができる。
+	// スレッドが2つ以上あれば、最後のスレッドはrootの局面の詰み探索を担当する。
+	const std::string sfen = pos.sfen();
+	for (Thread* th : *this)
+	{
+		th->nodes = 0;
+		SEARCH_STATS(th->stats = Search::Stats());
+		th->rootDepth = th->completedDepth = 0;
+		th->pvIdx = 0;
+		th->bestMoveChanges = 0;
+		th->lastBestMove = MOVE_NONE;
+		th->lastBestMoveDepth = 0;
+		th->nmpMinPly = 0;
+		th->mateSearcher = size() >= 2 && th == back() && Options["RootMateSearch"];
+		th->rootMoves = rootMoves;
+		th->rootPos.set(sfen, &th->rootState, th);
+		th->rootState = setupStates->back();
+	}
+
+	main()->start_searching();
+}
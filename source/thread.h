@@ -0,0 +1,239 @@
+﻿#ifndef _THREAD_H_
+#define _THREAD_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "position.h"
+#include "search.h"
+#include "movepick.h"
+
+// --------------------
+//  探索スレッド
+// --------------------
+
+// 探索時に用いるスレッド。Lazy SMPで並列探索を行う。
+// 各スレッドは自分専用のPosition(rootPos)、StateInfo、RootMovesを持ち、
+// 他のスレッドとは置換表と停止フラグ(Threads.stop)だけを共有する。
+class Thread
+{
+	// exit == trueになったらスレッドを終了する。
+	// searching == trueであれば探索中。
+	std::mutex mutex;
+	std::condition_variable cv;
+	size_t idx;
+	bool exit = false, searching = true; // 初期化時にidle_loop()に入るまで待つためにtrueにしておく。
+	std::thread stdThread;
+
+public:
+	// n : スレッドID(main threadが0)
+	explicit Thread(size_t n);
+	virtual ~Thread();
+
+	// 探索を行う。main thread以外はこれが反復深化のループ。
+	virtual void search();
+
+	// rootの局面の詰みをdf-pnで探す。mateSearcherであれば、search()の代わりにこれを行う。
+	void search_mate();
+
+	// スレッドごとに保持している探索用のテーブルなどを初期化する。(isreadyのときに呼び出される)
+	void clear();
+
+	// スレッド起動後、この関数が呼び出される。探索の開始を待機する。
+	void idle_loop();
+
+	// idle_loop()で待機しているスレッドに探索を開始させる。
+	void start_searching();
+
+	// 探索が終わるのを待機する。(searchingフラグがfalseになるのを待つ)
+	void wait_for_search_finished();
+
+	// スレッドID。main threadなら0。
+	size_t thread_id() const { return idx; }
+
+	// --- 探索用の変数
+
+	// このスレッドの探索開始局面
+	Position rootPos;
+
+	// rootPosのStateInfo。setup moves(positionコマンドで与えられた指し手)の末尾のStateInfoのコピー。
+	StateInfo rootState;
+
+	// このスレッドでの探索開始局面の指し手の集合。
+	Search::RootMoves rootMoves;
+
+	// 探索用のstack。(ss - 2)と(ss + 2)まで参照するので余分に確保しておく。
+	// 再帰呼び出しのたびにstackに確保すると大きいので、スレッドごとに確保しておく。
+	Search::Stack stack[MAX_PLY + 4];
+
+	// 探索中にdo_move()で用いるStateInfo。stack[i].stがstates[i]を指す。
+	StateInfo states[MAX_PLY + 4];
+
+	// MovePickerの指し手生成バッファ。探索の再帰の順にMAX_MOVES個ずつ貸し出して、連続したメモリに詰めて使う。
+	// MovePickerは各plyで、singular extensionの判定のための探索のものと合わせて最大2つ同時に使われる。
+	// (MAX_PLY以上のplyではMovePickerを使わない)
+	ExtMove moveBuffer[2 * MAX_PLY * MAX_MOVES];
+
+	// moveBufferの使用中の領域の末尾
+	ExtMove* moveBufferEnd;
+
+	// moveBufferからMAX_MOVES個の要素を借りる。MovePickerのコンストラクタから呼び出される。
+	ExtMove* acquire_moves()
+	{
+		ExtMove* m = moveBufferEnd;
+		moveBufferEnd += MAX_MOVES;
+		ASSERT_LV3(moveBufferEnd <= std::end(moveBuffer));
+		return m;
+	}
+
+	// acquire_moves()で借りた要素を返す。借りたのと逆の順に返すこと。MovePickerのデストラクタから呼び出される。
+	void release_moves(ExtMove* m)
+	{
+		ASSERT_LV3(m + MAX_MOVES == moveBufferEnd);
+		moveBufferEnd = m;
+	}
+
+	// このスレッドで探索したノード数(≒Position::do_move()の呼び出し回数)
+	std::atomic<u64> nodes;
+
+	// このスレッドでの探索の統計情報。USE_SEARCH_STATSがdefineされているときだけ集計される。
+	Search::Stats stats;
+
+	// 反復深化の深さ
+	int rootDepth;
+
+	// 反復深化で最後に完了した深さ
+	int completedDepth;
+
+	// MultiPVで、いま探索しているPVの番号(0なら最善手)
+	size_t pvIdx;
+
+	// PV nodeで、rootから最大何手目まで探索したか(選択深さ)。PVごとに0に戻す。
+	int selDepth;
+
+	// rootで2番目以降の指し手が最善手になった回数。main threadが時間制御に用いたあと0に戻す。
+	std::atomic<u64> bestMoveChanges;
+
+	// 反復深化で最後に最善手が変わった深さと、そのときの最善手
+	Move lastBestMove;
+	int lastBestMoveDepth;
+
+	// null moveの検証探索中は、nmpColor側の手番でplyがnmpMinPly未満の局面ではnull moveを行わない。
+	int nmpMinPly;
+	Color nmpColor;
+
+	// このスレッドが、通常の探索の代わりにrootの局面の詰み探索(df-pn)を行うか
+	bool mateSearcher;
+
+	// --- 指し手オーダリング用のテーブル
+
+	// 静かな指し手のhistory
+	ButterflyHistory mainHistory;
+
+	// 捕獲する指し手のhistory
+	CapturePieceToHistory captureHistory;
+
+	// 1手前、2手前の指し手との組み合わせによるhistory
+	// [NO_PIECE][0]は、1手前、2手前の指し手がない(rootより前、null move)ときに参照する番兵。
+	ContinuationHistory continuationHistory;
+
+	// 直前の指し手に対する応手
+	CounterMoveHistory counterMoves;
+};
+
+// 探索のmain thread
+// 時間制御と、探索終了後のbest threadの選択とbestmoveの出力を担当する。
+struct MainThread : public Thread
+{
+	using Thread::Thread;
+
+	void search() override;
+
+	// 一定回数の呼び出しごとに経過時間を調べて、思考時間の上限に達していればThreads.stopをtrueにする。
+	// main threadの探索中に、search()、qsearch()、詰み探索から呼び出される。
+	void check_time();
+
+	// check_time()で時刻を調べるまでの残りの呼び出し回数
+	int callsCnt;
+
+	// check_time()で時刻を調べる間隔(呼び出し回数)
+	static constexpr int CheckTimeInterval = 1024;
+
+	// ponder中であればtrue。ponderhitでfalseになり、通常の探索に切り替わる。
+	// ponder中は、時間による探索の終了は行わない。
+	std::atomic_bool ponder;
+
+	// ponder中に探索を終了してよい時間になったらtrueにしておき、ponderhitが来たらすぐに探索を終了する。
+	std::atomic_bool stopOnPonderhit;
+
+	// 今回のgoコマンドがponderで、まだponderhitのあとの思考時間の調整をしていないならtrue。
+	bool ponderhitPending;
+
+	// 前回のgoコマンドで返した指し手の評価値。評価値が下がっているなら思考時間を増やすのに用いる。
+	// 対局開始時(前回の探索がない)はVALUE_INFINITE。
+	Value bestPreviousScore;
+
+	// 前回のgoコマンドで、最善手が安定していたために思考時間を減らした割合
+	double previousTimeReduction;
+};
+
+// --------------------
+//   スレッドプール
+// --------------------
+
+// 探索スレッドの集合。Threads.front()がmain thread。
+struct ThreadPool : public std::vector<Thread*>
+{
+	// main threadに思考を開始させる。
+	// ponderMode : "go ponder"であればtrue。ponderhitかstopが来るまでbestmoveを返さない。
+	void start_thinking(const Position& pos, StateListPtr& states, const Search::LimitsType& limits, bool ponderMode = false);
+
+	// 各スレッドのclear()を呼び出す。
+	void clear();
+
+	// スレッド数を変更する。
+	// USIのoption"Threads"が変更されたときに呼び出される。
+	void set(size_t requested);
+
+	// main thread(探索開始時にbestmoveを返すスレッド)を返す。
+	MainThread* main() const { return static_cast<MainThread*>(front()); }
+
+	// すべてのスレッドの探索ノード数の合計
+	u64 nodes_searched() const;
+
+	// main thread以外の探索を開始させる。
+	void start_searching();
+
+	// main thread以外の探索が終わるのを待つ。
+	void wait_for_search_finished() const;
+
+	// stopがtrueになるか、goコマンドを受け取ってからの経過時間がdeadline[ms]に達するまで待機する。
+	// ponder中であれば、ponderhitが来たところで(思考時間無制限でなければ)待機を終える。
+	// deadlineがINT64_MAXなら時間の制限なく待機する。待機を終えたらstopをtrueにする。
+	// 探索ノードがなくてcheck_time()が呼び出されないとき(思考時間無制限かponder中に反復深化を終えたときなど)に用いる。
+	void wait_for_stop(TimePoint deadline);
+
+	// stopをtrueにして、wait_for_stop()で待機しているスレッドを起こす。
+	void stop_searching();
+
+	// ponderhitを受け取ったときに呼び出す。ponderを通常の探索に切り替えて、wait_for_stop()で待機しているスレッドを起こす。
+	void ponderhit();
+
+	// 探索中にこれがtrueになったら探索を即座に終了すること。
+	std::atomic_bool stop;
+
+private:
+	// wait_for_stop()で待機するための条件変数
+	std::mutex stopMutex;
+	std::condition_variable stopCv;
+
+	// 現局面までのStateInfoのlist。探索中に参照されるので、探索が終わるまで保持しておく。
+	StateListPtr setupStates;
+};
+
+extern ThreadPool Threads;
+
+#endif // _THREAD_H_
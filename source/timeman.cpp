@@ -0,0 +1,68 @@
+﻿#include <algorithm>
+
+#include "timeman.h"
+#include "usi.h"
+
+// 持ち時間制御。global object。
+TimeManagement Timeman;
+
+namespace {
+
+	// 残りの指し手の数(自分が指す回数)の見積もり。MoveHorizon - 自分がこれまでに指した回数で、MinMovesToGoを下限とする。
+	// 5五将棋は100手程度で終局することが多いので、序盤ほど多めに見積もって時間を残しておく。
+	constexpr int MoveHorizon = 50;
+	constexpr int MinMovesToGo = 10;
+
+	// 思考時間の上限は、目安のこの倍数まで。
+	constexpr int MaxRatio = 4;
+
+	// 思考時間の上限は、残り時間のこの割合まで。
+	constexpr int MaxStealDivisor = 4;
+}
+
+void TimeManagement::init(const Search::LimitsType& limits, Color us, int ply)
+{
+	// 通信の遅延などで時間切れにならないように、使える時間から差し引いておく時間[ms]
+	const TimePoint networkDelay = (int)Options["NetworkDelay"];
+
+	// 最低でもこれだけの時間は思考する[ms]
+	const TimePoint minimumTime = (int)Options["MinimumThinkingTime"];
+
+	const TimePoint time    = limits.time[us];
+	const TimePoint inc     = limits.inc[us];
+	const TimePoint byoyomi = limits.byoyomi[us];
+
+	// go mateであれば、指定された時間だけ詰み探索を行う
+	if (limits.mate)
+	{
+		optimumTime = maximumTime = limits.mate;
+		fixedTime = true;
+		return;
+	}
+
+	// 思考時間が指定されている(movetime)か、深さ、ノード数、思考時間無制限が指定されているなら持ち時間制御は行わない。
+	// movetimeはちょうどその時間だけ思考し、それ以外はstopされるか指定された深さ、ノード数に達するまで思考する。
+	if (!limits.use_time_management())
+	{
+		optimumTime = maximumTime = limits.movetime ? limits.movetime : INT64_MAX;
+		fixedTime = true;
+		return;
+	}
+
+	fixedTime = time == 0 && inc == 0;
+
+	// 今回の指し手に使える時間の上限。残り時間と秒読みを使い切ったところから、遅延の分を差し引いたもの。
+	// 加算時間は指したあとに加算されるので含めない。
+	const TimePoint limit = std::max(time + byoyomi - networkDelay, TimePoint(0));
+
+	// 残り時間を残りの指し手の数で均等に割り振る。加算時間と秒読みは毎回使い切る。
+	// 秒読みだけであれば、optimum == maximum == 秒読み - 遅延となる。
+	const int movesToGo = std::max(MinMovesToGo, MoveHorizon - ply / 2);
+
+	optimumTime = time / movesToGo + inc + byoyomi;
+	maximumTime = std::min(optimumTime * MaxRatio, time / MaxStealDivisor + inc + byoyomi);
+
+	// 最低思考時間を確保する。ただし、使える時間の上限は超えない。
+	optimumTime = std::min(std::max(optimumTime, minimumTime), limit);
+	maximumTime = std::min(std::max(maximumTime, minimumTime), limit);
+}
@@ -0,0 +1,46 @@
+﻿#ifndef _TIMEMAN_H_
+#define _TIMEMAN_H_
+
+#include "misc.h"
+#include "search.h"
+
+// --------------------
+//   持ち時間制御
+// --------------------
+
+// goコマンドで与えられた持ち時間(btime/wtime)、加算時間(binc/winc)、秒読み(byoyomi)と手数から、
+// 今回の指し手に使う思考時間を決める。
+// 経過時間はgoコマンドを受け取ったときにリセットされるTimeで計る。
+struct TimeManagement
+{
+	// 今回の思考時間を計算する。探索開始時にmain threadから呼び出される。
+	// us : 手番, ply : 開始局面からの手数
+	void init(const Search::LimitsType& limits, Color us, int ply);
+
+	// 今回の思考時間の目安[ms]。反復深化の1回の反復が終わったときにこれを超えていれば探索を終了する。
+	TimePoint optimum() const { return optimumTime; }
+
+	// 今回の思考時間の上限[ms]。これを超えたら反復の途中でも探索を終了する。
+	TimePoint maximum() const { return maximumTime; }
+
+	// ponderhitのあと、main threadから呼び出される。
+	// ponderの開始からの経過時間で思考時間を計っているが、自分の持ち時間が減り始めたのはponderhitからなので、
+	// 思考時間の上限をponderしていた時間だけ延ばす。思考時間の目安はそのままにしておく。
+	void on_ponderhit() { if (maximumTime != INT64_MAX) maximumTime += elapsed(); }
+
+	// 秒読みだけで持ち時間も加算時間もないならtrue。
+	// このときは思考時間を残しても次の手番以降で使えないので、毎回maximum()まで思考する。
+	bool fixed_time() const { return fixedTime; }
+
+	// goコマンドを受け取ってからの経過時間[ms]
+	TimePoint elapsed() const { return Time.elapsed(); }
+
+private:
+	TimePoint optimumTime;
+	TimePoint maximumTime;
+	bool fixedTime;
+};
+
+extern TimeManagement Timeman;
+
+#endif // _TIMEMAN_H_
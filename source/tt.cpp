@@ -0,0 +1,141 @@
+﻿#include <cstdlib>   // exit()
+#include <new>       // std::nothrow
+
+#include "tt.h"
+
+// 置換表。global object。
+TranspositionTable TT;
+
+// ----------------------------------
+//           TTEntry
+// ----------------------------------
+
+// data_のpack/unpack
+namespace {
+
+	inline u64 pack_data(Move m, Value v, Value ev, int d, u8 genBound)
+	{
+		return  (u64)(u16)m
+			| ((u64)(u16)(s16)v  << 16)
+			| ((u64)(u16)(s16)ev << 32)
+			| ((u64)(u8)(s8)d    << 48)
+			| ((u64)genBound     << 56);
+	}
+}
+
+bool TTEntry::read(Key k, TTData& ttData) const
+{
+	// key_とdata_は別々に書き込まれるので、書き込み途中のエントリーであれば一致しない。
+	const u64 data = data_.load(std::memory_order_relaxed);
+	if ((key_.load(std::memory_order_relaxed) ^ data) != k)
+		return false;
+
+	ttData.move  = (Move)(data & 0xffff);
+	ttData.value = (Value)(s16)(data >> 16);
+	ttData.eval  = (Value)(s16)(data >> 32);
+	ttData.depth = (int)(s8)(data >> 48);
+	ttData.bound = (Bound)((data >> 56) & 0x3);
+	ttData.is_pv = (data >> 58) & 0x1;
+
+	return true;
+}
+
+void TTEntry::save(Key k, Value v, bool pv, Bound b, int d, Move m, Value ev)
+{
+	ASSERT_LV3(DEPTH_NONE < d && d <= MAX_PLY);
+
+	const u64 old = data_.load(std::memory_order_relaxed);
+	const bool sameKey = (key_.load(std::memory_order_relaxed) ^ old) == k;
+
+	// 指し手がない場合は、同じ局面の指し手が格納されていればそれを残す。
+	if (m == MOVE_NONE && sameKey)
+		m = (Move)(old & 0xffff);
+
+	// 同じ局面で、より深い探索結果が格納されているなら評価値などは上書きしない。(ただしBOUND_EXACTは優先)
+	// 指し手は新しいほうがおそらく良いので、世代とともに更新しておく。
+	if (b != BOUND_EXACT && sameKey && d + 4 < (int)(s8)(old >> 48))
+	{
+		b = (Bound)((old >> 56) & 0x3);
+		v = (Value)(s16)(old >> 16);
+		ev = (Value)(s16)(old >> 32);
+		d = (int)(s8)(old >> 48);
+		pv = (old >> 58) & 0x1;
+	}
+
+	const u64 data = pack_data(m, v, ev, d, u8(TT.generation() | u8(pv) << 2 | b));
+	data_.store(data, std::memory_order_relaxed);
+	key_.store(k ^ data, std::memory_order_relaxed);
+}
+
+// ----------------------------------
+//        TranspositionTable
+// ----------------------------------
+
+TTEntry* TranspositionTable::probe(const Key key, bool& found, TTData& ttData) const
+{
+	TTEntry* const tte = first_entry(key);
+
+	for (int i = 0; i < ClusterSize; ++i)
+		if (tte[i].read(key, ttData))
+			return found = true, &tte[i];
+
+	// 見つからなかったので、置き換えるentryを選ぶ。
+	// 探索深さが浅いもの、世代が古いものほど置き換えられやすい。
+	// 世代の差(relative age)は8ずつ加算されているので、差分をとって、そのまま1世代 = 深さ8相当として扱う。
+	TTEntry* replace = tte;
+	for (int i = 1; i < ClusterSize; ++i)
+		if (  replace->depth8() - ((256 + generation8 - replace->generation8()) & 0xf8)
+			>  tte[i].depth8()  - ((256 + generation8 - tte[i].generation8())   & 0xf8))
+			replace = &tte[i];
+
+	ttData = TTData{ MOVE_NONE, VALUE_NONE, VALUE_NONE, DEPTH_NONE, BOUND_NONE, false };
+	return found = false, replace;
+}
+
+int TranspositionTable::hashfull() const
+{
+	// 先頭から1000 entryだけ調べて、今回の探索で書き込まれたものの数を返す。
+	int cnt = 0;
+	for (int i = 0; i < 1000 / ClusterSize; ++i)
+		for (int j = 0; j < ClusterSize; ++j)
+			cnt += table[i].entry[j].depth8() != DEPTH_NONE
+				&& table[i].entry[j].generation8() == generation8;
+
+	return cnt * 1000 / (ClusterSize * (1000 / ClusterSize));
+}
+
+void TranspositionTable::resize(size_t mbSize)
+{
+	size_t newClusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
+
+	// 同じサイズなら確保しなおす必要はない。
+	if (newClusterCount == clusterCount)
+		return;
+
+	// hashfull()で先頭1000 entry分を参照するので、それより小さくはしない。
+	clusterCount = std::max(newClusterCount, size_t(1000 / ClusterSize));
+
+	delete[] table;
+	table = new (std::nothrow) Cluster[clusterCount];
+	if (!table)
+	{
+		std::cout << "info string Error : Failed to allocate " << mbSize
+			<< "MB for transposition table." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	clear();
+}
+
+void TranspositionTable::clear()
+{
+	// 空のentryは、depth8がDEPTH_NONEで、key_ ^ data_ == 0となるようにしておく。
+	// これで、局面のhash keyが0でない限り、空のentryにhitすることはない。
+	const u64 empty = pack_data(MOVE_NONE, VALUE_NONE, VALUE_NONE, DEPTH_NONE, 0);
+	for (size_t i = 0; i < clusterCount; ++i)
+		for (auto& e : table[i].entry)
+		{
+			e.data_.store(empty, std::memory_order_relaxed);
+			e.key_.store(empty, std::memory_order_relaxed);
+		}
+}
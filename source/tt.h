@@ -0,0 +1,120 @@
+﻿#ifndef _TT_H_
+#define _TT_H_
+
+#include <atomic>
+
+#include "misc.h"
+
+// --------------------
+//       置換表
+// --------------------
+
+// 置換表から取り出した内容。
+// probe()した時点でのスナップショットなので、他のスレッドがその後にエントリーを書き換えても影響を受けない。
+struct TTData
+{
+	Move  move;   // 指し手(16bit)
+	Value value;  // 探索で得られた評価値
+	Value eval;   // 評価関数の値
+	int   depth;  // 探索深さ
+	Bound bound;  // valueが上界なのか下界なのか真の値なのか
+	bool  is_pv;  // PV nodeで得られた値であるか
+};
+
+// 置換表のエントリー。16byte。
+// 複数の探索スレッドから同時に読み書きされるので、lockはせずにkeyをdataとXORした値を格納しておく。(lockless hashing)
+// 書き込み途中のエントリーを読み出した場合や、他の局面のエントリーであった場合は、
+// 読み出したkeyとdataをXORしたものが局面のhash keyと一致しないので、それで検出できる。
+//
+// data_のbit layout
+//   bit 0..15  : move16
+//   bit 16..31 : value16
+//   bit 32..47 : eval16
+//   bit 48..55 : depth8 (符号つき)
+//   bit 56..63 : genBound8 (bit 0..1 = Bound, bit 2 = is_pv, bit 3..7 = generation)
+struct TTEntry
+{
+	// このエントリーに書き込む。
+	// k : 局面のhash key
+	// v : 探索で得られた評価値(value_to_tt()で補正したもの)
+	// pv : PV nodeであるか
+	// b : vの種類
+	// d : 探索深さ
+	// m : 指し手(MOVE_NONEなら、同じ局面の指し手が入っていればそれを残す)
+	// ev : 評価関数の値
+	void save(Key k, Value v, bool pv, Bound b, int d, Move m, Value ev);
+
+private:
+	friend struct TranspositionTable;
+
+	// このエントリーの現在の内容を取り出す。keyが一致しなければfalseが返る。
+	bool read(Key k, TTData& ttData) const;
+
+	// このエントリーの世代。
+	u8 generation8() const { return u8(data_.load(std::memory_order_relaxed) >> 56) & 0xf8; }
+
+	// このエントリーの探索深さ。
+	int depth8() const { return int(s8(data_.load(std::memory_order_relaxed) >> 48)); }
+
+	// key ^ data
+	std::atomic<u64> key_;
+
+	// 指し手、評価値などを64bitにpackしたもの
+	std::atomic<u64> data_;
+};
+
+// 置換表本体
+// 1つのClusterは64byte(cache lineのサイズ)で、TTEntryを4つ持つ。
+struct TranspositionTable
+{
+	// 置換表のなかから与えられたkeyに対応するentryを探す。
+	// 見つかったならfoundにtrueを設定し、ttDataにその内容を格納する。
+	// 見つからなかった場合は、foundにfalseを設定し、置き換えるべきentryを返す。
+	// いずれの場合も返し値のentryに対してsave()を呼び出して書き込む。
+	TTEntry* probe(const Key key, bool& found, TTData& ttData) const;
+
+	// 置換表の使用率を1000分率で返す。(USIプロトコルで統計情報として出力するのに使う)
+	int hashfull() const;
+
+	// 置換表のサイズを変更する。mbSize : 確保するメモリサイズ。MB単位。
+	void resize(size_t mbSize);
+
+	// 置換表のエントリーの全クリア
+	void clear();
+
+	// 新しい探索ごとにこの関数を呼び出す。(generationを加算する。)
+	// 下位3bitはBoundとis_pvに使っているので8ずつ加算する。
+	void new_search() { generation8 += 8; }
+
+	// 世代を返す。これはTTEntry::save()で使う。
+	u8 generation() const { return generation8; }
+
+	~TranspositionTable() { delete[] table; }
+
+private:
+	static constexpr int ClusterSize = 4;
+
+	struct alignas(64) Cluster {
+		TTEntry entry[ClusterSize];
+	};
+
+	static_assert(sizeof(Cluster) == 64, "Cluster size incorrect");
+
+	// keyの上位bitを用いてClusterの先頭のentryを返す。
+	TTEntry* first_entry(const Key key) const {
+		return &table[mul_hi64(key, clusterCount)].entry[0];
+	}
+
+	// 確保されているClusterの数
+	size_t clusterCount = 0;
+
+	// 置換表本体
+	Cluster* table = nullptr;
+
+	// 世代(8ずつ加算される)
+	u8 generation8 = 0;
+};
+
+extern TranspositionTable TT;
+
+#endif // _TT_H_
@@ -305,6 +305,22 @@ static bool aligned(Square sq1, Square sq2, Square sq3/* is ksq */)
 // 通常探索時の最大探索深さ
 constexpr int MAX_PLY = 127;
 
+// 置換表に格納されていないことを意味するdepth。置換表には8bitの符号つき整数で格納するので、これより小さなdepthは扱えない。
+constexpr int DEPTH_NONE = -128;
+
+// --------------------
+//     置換表の値の種類
+// --------------------
+
+// 置換表に格納するときの評価値の種類
+// 探索でfail lowしたならBOUND_UPPER(真の値はこれ以下)、fail highしたならBOUND_LOWER(真の値はこれ以上)。
+enum Bound {
+	BOUND_NONE,
+	BOUND_UPPER,
+	BOUND_LOWER,
+	BOUND_EXACT = BOUND_UPPER | BOUND_LOWER
+};
+
 // --------------------
 //        評価値
 // --------------------
@@ -478,6 +494,9 @@ constexpr bool is_drop(Move m) { return (m & MOVE_DROP) != 0; }
 // この関数は、0 〜 ((SQ_NB+7) * SQ_NB - 1)までの値が返る。
 constexpr int from_to(Move m) { return (int)(move_from(m) + (is_drop(m) ? (SQ_NB - 1) : 0)) * (int)SQ_NB + (int)move_to(m); }
 
+// from_to()の返す値の最大値+1。history tableなどの配列のサイズとして用いる。
+constexpr int FROM_TO_NB = ((int)SQ_NB + 7) * (int)SQ_NB;
+
 // 指し手が成りか？
 constexpr bool is_promote(Move m) { return (m & MOVE_PROMOTE) != 0; }
 
@@ -628,8 +647,11 @@ std::ostream& operator<<(std::ostream& os, Hand hand);
 //    指し手生成器
 // --------------------
 
-// 局面の合法手の最大数
-constexpr int MAX_MOVES = 600;
+// 局面で生成されうる指し手の数の最大値(指し手生成バッファの大きさ)
+// 5五将棋では、玉以外の駒の配置(手駒、盤上、盤上で成り)のすべての組み合わせについて
+// 盤上の駒の指し手の数の最大値と駒打ちの数の和を求めた上界が146手になる。(USI拡張コマンド"maxmoves"で計算と検証ができる)
+// 実際に見つかっている最大の合法手の数は138手。
+constexpr int MAX_MOVES = 146;
 
 // 生成する指し手の種類
 enum MOVE_GEN_TYPE
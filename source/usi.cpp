@@ -1,26 +1,34 @@
 ﻿#include "usi.h"
 #include "misc.h"
 #include "search.h"
+#include "thread.h"
+#include "tt.h"
+#include "perfstat.h"
 #include "evaluate.h"
 
+#include <algorithm>
 #include <sstream>
 #include <queue>
 
 using namespace std;
 
 void random_player_cmd(Position& pos, istringstream& is);
+void max_moves_cmd(istringstream& is);
 void user_test(Position& pos, istringstream& is);
 
 void is_ready_cmd(Position& pos, StateListPtr& states)
 {
+	// 探索中であれば、探索が終わるのを待ってから初期化する。
+	Threads.main()->wait_for_search_finished();
+
 	// --- 初期化
 
 	Search::clear();
-	Search::Stop = false;
+	Threads.stop = false;
 
 	// 平手局面に初期化する。
 	states = StateListPtr(new StateList(1));
-	pos.set_hirate(&states->back());
+	pos.set_hirate(&states->back(), Threads.main());
 
 	cout << "readyok" << endl;
 }
@@ -48,7 +56,7 @@ void position_cmd(Position& pos, istringstream& is, StateListPtr& states)
 
 	// 新しく渡す局面なので古いものは捨てて新しいものを作る。
 	states = StateListPtr(new StateList(1));
-	pos.set(sfen, &states->back());
+	pos.set(sfen, &states->back(), Threads.main());
 
 	while (is >> token && (m = USI::to_move(pos, token)) != MOVE_NONE)
 	{
@@ -65,6 +73,7 @@ void go_cmd(const Position& pos, istringstream& is, StateListPtr& states)
 {
 	Search::LimitsType limits;
 	string token;
+	bool ponderMode = false;
 	
 	// 思考時間時刻の初期化
 	Time.reset();
@@ -93,15 +102,58 @@ void go_cmd(const Position& pos, istringstream& is, StateListPtr& states)
 		// この探索ノード数で探索を打ち切る
 		else if (token == "nodes")     is >> limits.nodes;
 
+		// 持ち時間によらず、この時間[ms]だけ思考する
+		else if (token == "movetime")  is >> limits.movetime;
+
 		// 時間無制限。
 		else if (token == "infinite")  limits.infinite = 1;
+
+		// 相手の手番での先読み。ponderhitかstopが来るまでbestmoveを返さない。
+		else if (token == "ponder")    ponderMode = true;
+
+		// rootで探索する指し手を限定する。以降の指し手はすべて対象。
+		else if (token == "searchmoves")
+			while (is >> token)
+				limits.searchmoves.push_back(USI::to_move(pos, token));
+
+		// 詰み専用探索。"go mate 時間[ms]"か"go mate infinite"の形式。
+		else if (token == "mate") {
+			is >> token;
+			limits.mate = token == "infinite" ? INT64_MAX : atoll(token.c_str());
+		}
 	}
 
-	// goコマンドのデフォルトを1秒読みにする
-	if (limits.byoyomi[BLACK] == 0 && limits.inc[BLACK] == 0 && limits.time[BLACK] == 0)
+	// 持ち時間も探索の制限も指定されていなければ、1秒読みにする
+	if (limits.use_time_management()
+		&& limits.byoyomi[BLACK] == 0 && limits.inc[BLACK] == 0 && limits.time[BLACK] == 0)
 		limits.byoyomi[BLACK] = limits.byoyomi[WHITE] = 1000;
 
-	Search::start_thinking(pos, states, limits);
+	Threads.start_thinking(pos, states, limits, ponderMode);
+}
+
+// "setoption name X value Y"の形式でoptionの値を設定する。
+void setoption_cmd(istringstream& is)
+{
+	// 探索中に置換表やスレッドを解放しないように、探索が終わるのを待つ。
+	Threads.main()->wait_for_search_finished();
+
+	string token, name, value;
+
+	// "name"
+	is >> token;
+
+	// option名にはスペースを含むことがあるので"value"が来るまで連結する。
+	while (is >> token && token != "value")
+		name += (name.empty() ? "" : " ") + token;
+
+	// valueにもスペースを含むことがある。
+	while (is >> token)
+		value += (value.empty() ? "" : " ") + token;
+
+	if (Options.count(name))
+		Options[name] = value;
+	else
+		cout << "No such option: " << name << endl;
 }
 
 void USI::loop(int argc, char* argv[])
@@ -158,8 +210,19 @@ void USI::loop(int argc, char* argv[])
 		token.clear();
 		is >> skipws >> token;
 
-		if (token == "usi")
-			cout << engine_info() << "usiok" << endl;
+		// 探索中であれば探索を終了させる。main threadがbestmoveを出力する。
+		// quitのときは、探索スレッドの終了はmain()のThreads.set(0)で待つ。
+		if (token == "quit" || token == "stop" || token == "gameover")
+			Threads.stop_searching();
+
+		// 相手の予想手が当たったので、ponderを通常の探索に切り替える。
+		else if (token == "ponderhit")
+			Threads.ponderhit();
+
+		else if (token == "usi")
+			cout << engine_info() << Options << "usiok" << endl;
+
+		else if (token == "setoption") setoption_cmd(is);
 
 		else if (token == "go") go_cmd(pos, is, states);
 
@@ -180,6 +243,12 @@ void USI::loop(int argc, char* argv[])
 
 		else if (token == "compiler") cout << compiler_info() << endl;
 
+		// 前回のgoコマンドでの探索の統計情報を出力する。(USE_SEARCH_STATSがdefineされているとき)
+		else if (token == "stats") Search::LastStats.print();
+
+		// 探索、指し手生成などのハードウェアカウンタの計測結果を出力する。(USE_PERF_STATがdefineされているとき)
+		else if (token == "perfstat") PerfStat::perfstat_cmd(is);
+
 		else if (token == "sfen") position_cmd(pos, is, states);
 
 		// ログファイルの書き出しのon
@@ -202,6 +271,9 @@ void USI::loop(int argc, char* argv[])
 		// ランダムプレイヤーによるテスト
 		else if (token == "rp") random_player_cmd(pos, is);
 
+		// 生成されうる指し手の数の上界の計算と検証
+		else if (token == "maxmoves") max_moves_cmd(is);
+
 		// ユーザーによるテスト用コマンド
 		else if (token == "user") user_test(pos, is);
 
@@ -219,37 +291,49 @@ std::string USI::pv(const Position& pos, int depth)
 	std::stringstream ss;
 	TimePoint elapsed = Time.elapsed() + 1;
 
-	const auto& rootMoves = Search::rootMoves;
-	uint64_t nodes_searched = Search::Nodes;
+	const auto& rootMoves = pos.this_thread()->rootMoves;
+	const size_t pvIdx = pos.this_thread()->pvIdx;
+	const size_t multiPV = std::min(size_t(int(Options["MultiPV"])), rootMoves.size());
+	uint64_t nodes_searched = Threads.nodes_searched();
 
-	bool updated = rootMoves[0].score != VALUE_INFINITE;
+	// MultiPVであれば、上位multiPV個の指し手について1行ずつ出力する。
+	for (size_t i = 0; i < multiPV; ++i)
+	{
+		// 今回の反復で探索済みのPVであるか。探索していなければ前回の反復の結果を出力する。
+		bool updated = i <= pvIdx && rootMoves[i].score != -VALUE_INFINITE;
 
-	if (depth == 1 && !updated)
-		goto END;
+		if (depth == 1 && !updated)
+			continue;
 
-	{
 		int d = updated ? depth : depth - 1;
-		Value v = updated ? rootMoves[0].score : rootMoves[0].previousScore;
+		Value v = updated ? rootMoves[i].score : rootMoves[i].previousScore;
 
 		if (v == -VALUE_INFINITE)
-			goto END;
+			continue;
 
 		if (ss.rdbuf()->in_avail())
 			ss << endl;
-		
+
 		ss << "info"
 			 << " depth "    << d
-			 << " seldepth " << rootMoves[0].selDepth
-			 << " score "    << USI::value(v);
+			 << " seldepth " << rootMoves[i].selDepth;
+
+		if (multiPV > 1)
+			ss << " multipv " << i + 1;
+
+		ss << " score "    << USI::value(v);
 
 		ss << " nodes " << nodes_searched
 			 << " nps "   << nodes_searched * 1000 / elapsed;
 
-		ss << " time " << elapsed;
-		ss << " pv " << rootMoves[0].pv[0];
+		ss << " hashfull " << TT.hashfull()
+			 << " time "     << elapsed;
+
+		ss << " pv";
+		for (Move m : rootMoves[i].pv)
+			ss << ' ' << m;
 	}
 
-END:;
 	return ss.str();
 }
 
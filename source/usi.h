@@ -1,12 +1,74 @@
 ﻿#ifndef _USI_H_
 #define _USI_H_
 
+#include <map>
+
 #include "types.h"
 
 class Position;
 
 namespace USI
 {
+	class Option;
+
+	// USIのoption名と値の対応を保持するmap。option名は大文字小文字を区別しない。
+	struct CaseInsensitiveLess {
+		bool operator() (const std::string&, const std::string&) const;
+	};
+
+	typedef std::map<std::string, Option, CaseInsensitiveLess> OptionsMap;
+
+	// USIプロトコルで指定されるoptionの内容を保持するclass
+	class Option
+	{
+		// 値が変更されたときに呼び出されるハンドラ
+		typedef void(*OnChange)(const Option&);
+
+	public:
+		// button型
+		Option(OnChange f = nullptr);
+
+		// check型
+		Option(bool v, OnChange f = nullptr);
+
+		// string型
+		Option(const char* v, OnChange f = nullptr);
+
+		// spin型
+		Option(int v, int minv, int maxv, OnChange f = nullptr);
+
+		// USIプロトコル経由で値を設定されたときにそれをcurrentValueに反映させる。
+		Option& operator=(const std::string&);
+
+		// 起動時に設定を代入する。(option名の順番を記録しておくのに使う)
+		void operator<<(const Option&);
+
+		// spin型, check型のときに値を取り出す
+		operator int() const;
+
+		// string型のときに値を取り出す
+		operator std::string() const;
+
+	private:
+		friend std::ostream& operator<<(std::ostream&, const OptionsMap&);
+
+		std::string defaultValue, currentValue, type;
+
+		// spin型のときの最小値と最大値
+		int min, max;
+
+		// "usi"コマンドで出力するときの順番
+		size_t idx;
+
+		OnChange on_change;
+	};
+
+	// optionのdefault値を設定する。
+	void init(OptionsMap&);
+
+	// "usi"コマンドに対してoptionの一覧をUSIプロトコルの形式で出力する。
+	std::ostream& operator<<(std::ostream&, const OptionsMap&);
+
 	// USIメッセージ応答部(起動時に、各種初期化のあとに呼び出される)
 	void loop(int argc, char* argv[]);
 
@@ -32,4 +94,7 @@ namespace USI
 // 局面は初期化されない。
 void is_ready();
 
+// USIプロトコルで設定されたoptionの値。
+extern USI::OptionsMap Options;
+
 #endif
\ No newline at end of file
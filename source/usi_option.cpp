@@ -0,0 +1,163 @@
+﻿#include <sstream>
+
+#include "usi.h"
+#include "tt.h"
+#include "thread.h"
+#include "mate.h"
+
+using namespace std;
+
+// USIプロトコルで設定されたoptionの値。
+USI::OptionsMap Options;
+
+namespace USI
+{
+	// --------------------
+	//  optionのハンドラ
+	// --------------------
+
+	// 置換表のサイズが変更されたときに呼び出される。
+	void on_hash_size(const Option& o) { TT.resize(size_t(int(o))); }
+
+	// 探索スレッド数が変更されたときに呼び出される。
+	void on_threads(const Option& o) { Threads.set(size_t(int(o))); }
+
+	// 詰み探索用の置換表のサイズが変更されたときに呼び出される。
+	void on_mate_hash_size(const Option& o) { MateTT.resize(size_t(int(o))); }
+
+	// --------------------
+	//   optionの初期化
+	// --------------------
+
+	bool CaseInsensitiveLess::operator() (const string& s1, const string& s2) const
+	{
+		return lexicographical_compare(s1.begin(), s1.end(), s2.begin(), s2.end(),
+			[](char c1, char c2) { return tolower(c1) < tolower(c2); });
+	}
+
+	void init(OptionsMap& o)
+	{
+		// 置換表のサイズ。[MB]で指定。
+		o["Hash"] << Option(16, 1, 1024 * 1024, on_hash_size);
+
+		// 探索スレッド数
+		o["Threads"] << Option(1, 1, 512, on_threads);
+
+		// 上位何個の指し手の読み筋を出力するか。2以上なら、その数の指し手をそれぞれ独立に探索する。(検討用)
+		o["MultiPV"] << Option(1, 1, 800);
+
+		// 詰み探索(df-pn)用の置換表のサイズ。[MB]で指定。
+		o["MateHash"] << Option(16, 1, 1024 * 1024, on_mate_hash_size);
+
+		// 探索スレッドが2つ以上あるとき、そのうちの1つでrootの局面の詰みをdf-pnで探すか
+		o["RootMateSearch"] << Option(true);
+
+		// 通信の遅延などを見込んで、持ち時間と秒読みから差し引いておく時間。[ms]で指定。
+		o["NetworkDelay"] << Option(40, 0, 10000);
+
+		// 最低思考時間。持ち時間が少なくなっても、使える時間の範囲でこれだけは思考する。[ms]で指定。
+		o["MinimumThinkingTime"] << Option(100, 0, 100000);
+
+		// 浅い深さでの枝刈りのマージン。自己対局で調整するためにoptionにしてある。
+		// RazoringMargin      : depth 1で、評価値がalphaをこれ以上下回るなら静止探索の値を返す。
+		// FutilityMargin      : 評価値がbetaを残り深さ1あたりこれ以上上回るなら枝刈りする。(reverse futility)
+		// FutilityMarginQuiet : 静かな指し手を指しても、評価値が削減後の深さ1あたりこれだけ上がってもalphaに届かないなら枝刈りする。
+		o["RazoringMargin"] << Option(600, 0, 10000);
+		o["FutilityMargin"] << Option(170, 0, 10000);
+		o["FutilityMarginQuiet"] << Option(150, 0, 10000);
+	}
+
+	// "usi"コマンドに対して、optionの一覧を登録順に出力する。
+	std::ostream& operator<<(std::ostream& os, const OptionsMap& om)
+	{
+		for (size_t idx = 0; idx < om.size(); ++idx)
+			for (const auto& it : om)
+				if (it.second.idx == idx)
+				{
+					const Option& o = it.second;
+					os << "option name " << it.first << " type " << o.type;
+
+					if (o.type == "string" || o.type == "check")
+						os << " default " << o.defaultValue;
+					else if (o.type == "spin")
+						os << " default " << o.defaultValue
+						   << " min " << o.min
+						   << " max " << o.max;
+
+					os << endl;
+					break;
+				}
+
+		return os;
+	}
+
+	// --------------------
+	//    Option class
+	// --------------------
+
+	Option::Option(OnChange f) : type("button"), min(0), max(0), on_change(f) {}
+
+	Option::Option(bool v, OnChange f) : type("check"), min(0), max(0), on_change(f)
+	{
+		defaultValue = currentValue = (v ? "true" : "false");
+	}
+
+	Option::Option(const char* v, OnChange f) : type("string"), min(0), max(0), on_change(f)
+	{
+		defaultValue = currentValue = v;
+	}
+
+	Option::Option(int v, int minv, int maxv, OnChange f) : type("spin"), min(minv), max(maxv), on_change(f)
+	{
+		defaultValue = currentValue = std::to_string(v);
+	}
+
+	Option::operator int() const
+	{
+		ASSERT_LV1(type == "check" || type == "spin");
+		return (type == "spin" ? atoi(currentValue.c_str()) : currentValue == "true");
+	}
+
+	Option::operator std::string() const
+	{
+		ASSERT_LV1(type == "string");
+		return currentValue;
+	}
+
+	// 登録順を記録しておき、"usi"コマンドに対してその順で出力する。
+	void Option::operator<<(const Option& o)
+	{
+		static size_t insert_order = 0;
+
+		*this = o;
+		idx = insert_order++;
+	}
+
+	// USIプロトコル経由で値が設定されたときに呼び出される。
+	// 範囲外の値であれば無視する。
+	Option& Option::operator=(const string& v)
+	{
+		ASSERT_LV1(!type.empty());
+
+		if ((type != "button" && v.empty())
+			|| (type == "check" && v != "true" && v != "false"))
+			return *this;
+
+		if (type == "spin")
+		{
+			// -fno-exceptionsでbuildしているので、stoi()ではなくstringstreamで数値に変換する。
+			int n;
+			istringstream is(v);
+			if (!(is >> n) || n < min || n > max)
+				return *this;
+		}
+
+		if (type != "button")
+			currentValue = v;
+
+		if (on_change)
+			on_change(*this);
+
+		return *this;
+	}
+}